@@ -0,0 +1,472 @@
+#include "descriptor_heap.hpp"
+
+#include <stdexcept>
+#include <string_view>
+
+namespace experiment {
+
+static constexpr uint64_t pack_head(uint64_t tag, uint32_t slot) noexcept {
+    return (tag << 32) | slot;
+}
+static constexpr uint32_t head_slot(uint64_t head) noexcept {
+    return static_cast<uint32_t>(head & UINT32_MAX);
+}
+static constexpr uint64_t head_tag(uint64_t head) noexcept {
+    return head >> 32;
+}
+
+/// @see descriptor_slot_allocator::states
+enum slot_state : uint32_t {
+    slot_free = 0,
+    slot_allocated = 1,
+    slot_retired = 2,
+};
+
+descriptor_slot_allocator::descriptor_slot_allocator(uint32_t _capacity) noexcept(false)
+    : capacity{_capacity}, free_head{pack_head(0, invalid)}, retired_head{pack_head(0, invalid)},
+      next{std::make_unique<std::atomic_uint32_t[]>(_capacity)},
+      retire_values{std::make_unique<std::atomic_uint64_t[]>(_capacity)},
+      states{std::make_unique<std::atomic_uint32_t[]>(_capacity)} {
+    if (capacity == 0 || capacity == invalid)
+        throw std::invalid_argument{"descriptor_slot_allocator capacity"};
+}
+
+uint32_t descriptor_slot_allocator::get_capacity() const noexcept {
+    return capacity;
+}
+
+/// @note the tag is increased for each modification of the head to prevent ABA
+void descriptor_slot_allocator::push(std::atomic_uint64_t &head, uint32_t slot) noexcept {
+    uint64_t expected = head.load(std::memory_order_relaxed);
+    do {
+        next[slot].store(head_slot(expected), std::memory_order_relaxed);
+    } while (!head.compare_exchange_weak(expected, pack_head(head_tag(expected) + 1, slot), std::memory_order_release,
+                                         std::memory_order_relaxed));
+}
+
+uint32_t descriptor_slot_allocator::pop(std::atomic_uint64_t &head) noexcept {
+    uint64_t expected = head.load(std::memory_order_acquire);
+    while (head_slot(expected) != invalid) {
+        const uint32_t slot = head_slot(expected);
+        const uint32_t following = next[slot].load(std::memory_order_relaxed);
+        if (head.compare_exchange_weak(expected, pack_head(head_tag(expected) + 1, following),
+                                       std::memory_order_acquire, std::memory_order_acquire))
+            return slot;
+    }
+    return invalid;
+}
+
+uint32_t descriptor_slot_allocator::allocate() noexcept {
+    uint32_t slot = pop(free_head);
+    if (slot == invalid) {
+        // never used slots
+        slot = bump.load(std::memory_order_relaxed);
+        do {
+            if (slot >= capacity)
+                return invalid;
+        } while (!bump.compare_exchange_weak(slot, slot + 1, std::memory_order_relaxed));
+    }
+    states[slot].store(slot_allocated, std::memory_order_relaxed);
+    return slot;
+}
+
+bool descriptor_slot_allocator::release(uint32_t slot, uint64_t fence_value) noexcept {
+    if (slot >= capacity)
+        return false;
+    // pushing a slot twice makes a cycle in the retired list
+    uint32_t expected = slot_allocated;
+    if (states[slot].compare_exchange_strong(expected, slot_retired, std::memory_order_relaxed) == false)
+        return false;
+    retire_values[slot].store(fence_value, std::memory_order_relaxed);
+    push(retired_head, slot);
+    return true;
+}
+
+uint32_t descriptor_slot_allocator::collect(uint64_t completed) noexcept {
+    // detach the whole retired list. no other thread can reach the nodes after this
+    uint64_t expected = retired_head.load(std::memory_order_acquire);
+    do {
+        if (head_slot(expected) == invalid)
+            return 0;
+    } while (!retired_head.compare_exchange_weak(expected, pack_head(head_tag(expected) + 1, invalid),
+                                                 std::memory_order_acquire, std::memory_order_acquire));
+
+    uint32_t count = 0;
+    for (uint32_t slot = head_slot(expected); slot != invalid;) {
+        const uint32_t following = next[slot].load(std::memory_order_relaxed);
+        if (retire_values[slot].load(std::memory_order_relaxed) <= completed) {
+            states[slot].store(slot_free, std::memory_order_relaxed);
+            push(free_head, slot);
+            ++count;
+        } else {
+            push(retired_head, slot);
+        }
+        slot = following;
+    }
+    return count;
+}
+
+static bool is_heap_type(vk::DescriptorType type) noexcept {
+    switch (type) {
+    case vk::DescriptorType::eStorageBuffer:
+    case vk::DescriptorType::eUniformBuffer:
+    case vk::DescriptorType::eSampledImage:
+    case vk::DescriptorType::eStorageImage:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool has_device_extension(vk::PhysicalDevice pdevice, const vk::DispatchLoaderDynamic &dispatch,
+                                  std::string_view name) noexcept(false) {
+    for (const vk::ExtensionProperties &ep : pdevice.enumerateDeviceExtensionProperties(nullptr, dispatch))
+        if (name == ep.extensionName.data())
+            return true;
+    return false;
+}
+
+static bool supports_update_after_bind(const vk::PhysicalDeviceDescriptorIndexingFeatures &features,
+                                       vk::DescriptorType type) noexcept {
+    if (!features.runtimeDescriptorArray || !features.descriptorBindingPartiallyBound)
+        return false;
+    switch (type) {
+    case vk::DescriptorType::eStorageBuffer:
+        return features.descriptorBindingStorageBufferUpdateAfterBind;
+    case vk::DescriptorType::eUniformBuffer:
+        return features.descriptorBindingUniformBufferUpdateAfterBind;
+    case vk::DescriptorType::eSampledImage:
+        return features.descriptorBindingSampledImageUpdateAfterBind;
+    case vk::DescriptorType::eStorageImage:
+        return features.descriptorBindingStorageImageUpdateAfterBind;
+    default:
+        return false;
+    }
+}
+
+descriptor_heap_mode query_descriptor_heap_mode(vk::PhysicalDevice pdevice, const vk::DispatchLoaderDynamic &dispatch,
+                                                vk::DescriptorType type) noexcept {
+    if (is_heap_type(type) == false || dispatch.vkGetPhysicalDeviceFeatures2 == nullptr)
+        return descriptor_heap_mode::none;
+    try {
+        const uint32_t api_version = pdevice.getProperties(dispatch).apiVersion;
+        const bool indexing = api_version >= VK_API_VERSION_1_2 ||
+                              has_device_extension(pdevice, dispatch, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        const bool descriptor_buffer = has_device_extension(pdevice, dispatch, VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME);
+
+        vk::PhysicalDeviceDescriptorIndexingFeatures features0{};
+        vk::PhysicalDeviceDescriptorBufferFeaturesEXT features1{};
+        vk::PhysicalDeviceBufferDeviceAddressFeatures features2{};
+        vk::PhysicalDeviceFeatures2 features{};
+        void **chain = &features.pNext;
+        if (indexing) {
+            *chain = &features0;
+            chain = &features0.pNext;
+        }
+        if (descriptor_buffer) {
+            *chain = &features1;
+            features1.pNext = &features2;
+        }
+        pdevice.getFeatures2(&features, dispatch);
+
+        if (indexing && supports_update_after_bind(features0, type))
+            return descriptor_heap_mode::descriptor_indexing;
+        if (descriptor_buffer && features1.descriptorBuffer && features2.bufferDeviceAddress)
+            return descriptor_heap_mode::descriptor_buffer;
+    } catch (const vk::SystemError &) {
+    }
+    return descriptor_heap_mode::none;
+}
+
+static void check_capacity(uint32_t capacity, uint32_t per_set, uint32_t per_stage,
+                           uint32_t per_stage_resources) noexcept(false) {
+    // the binding is visible to all stages
+    if (capacity > per_set || capacity > per_stage || capacity > per_stage_resources)
+        throw std::invalid_argument{"descriptor_heap capacity exceeds the device limits"};
+}
+
+static void check_update_after_bind_capacity(vk::PhysicalDevice pdevice, const vk::DispatchLoaderDynamic &dispatch,
+                                             vk::DescriptorType type, uint32_t capacity) noexcept(false) {
+    vk::PhysicalDeviceDescriptorIndexingProperties props0{};
+    vk::PhysicalDeviceProperties2 props1{};
+    props1.setPNext(&props0);
+    pdevice.getProperties2(&props1, dispatch);
+    const uint32_t resources = props0.maxPerStageUpdateAfterBindResources;
+    switch (type) {
+    case vk::DescriptorType::eStorageBuffer:
+        return check_capacity(capacity, props0.maxDescriptorSetUpdateAfterBindStorageBuffers,
+                              props0.maxPerStageDescriptorUpdateAfterBindStorageBuffers, resources);
+    case vk::DescriptorType::eUniformBuffer:
+        return check_capacity(capacity, props0.maxDescriptorSetUpdateAfterBindUniformBuffers,
+                              props0.maxPerStageDescriptorUpdateAfterBindUniformBuffers, resources);
+    case vk::DescriptorType::eSampledImage:
+        return check_capacity(capacity, props0.maxDescriptorSetUpdateAfterBindSampledImages,
+                              props0.maxPerStageDescriptorUpdateAfterBindSampledImages, resources);
+    default:
+        return check_capacity(capacity, props0.maxDescriptorSetUpdateAfterBindStorageImages,
+                              props0.maxPerStageDescriptorUpdateAfterBindStorageImages, resources);
+    }
+}
+
+static void check_descriptor_set_capacity(const vk::PhysicalDeviceLimits &limits, vk::DescriptorType type,
+                                          uint32_t capacity) noexcept(false) {
+    const uint32_t resources = limits.maxPerStageResources;
+    switch (type) {
+    case vk::DescriptorType::eStorageBuffer:
+        return check_capacity(capacity, limits.maxDescriptorSetStorageBuffers,
+                              limits.maxPerStageDescriptorStorageBuffers, resources);
+    case vk::DescriptorType::eUniformBuffer:
+        return check_capacity(capacity, limits.maxDescriptorSetUniformBuffers,
+                              limits.maxPerStageDescriptorUniformBuffers, resources);
+    case vk::DescriptorType::eSampledImage:
+        return check_capacity(capacity, limits.maxDescriptorSetSampledImages,
+                              limits.maxPerStageDescriptorSampledImages, resources);
+    default:
+        return check_capacity(capacity, limits.maxDescriptorSetStorageImages,
+                              limits.maxPerStageDescriptorStorageImages, resources);
+    }
+}
+
+static uint32_t find_memory_type(vk::PhysicalDevice pdevice, const vk::DispatchLoaderDynamic &dispatch,
+                                 uint32_t requirement, vk::MemoryPropertyFlags flags) noexcept(false) {
+    vk::PhysicalDeviceMemoryProperties physical = pdevice.getMemoryProperties(dispatch);
+    for (uint32_t index = 0; index < physical.memoryTypeCount; ++index) {
+        const uint32_t type_bits = (1 << index);
+        if ((requirement & type_bits) && (physical.memoryTypes[index].propertyFlags & flags) == flags)
+            return index;
+    }
+    throw std::runtime_error{"device memory property not found"};
+}
+
+descriptor_heap::descriptor_heap(vk::PhysicalDevice pdevice, vk::Device _device,
+                                 const vk::DispatchLoaderDynamic &_dispatch, descriptor_heap_mode _mode,
+                                 vk::DescriptorType _type, uint32_t capacity, bool _robust_buffer_access) noexcept(false)
+    : device{_device}, dispatch{_dispatch}, mode{_mode}, type{_type}, robust_buffer_access{_robust_buffer_access},
+      slots{capacity} {
+    if (is_heap_type(type) == false)
+        throw std::invalid_argument{"descriptor_heap type"};
+    try {
+        if (mode == descriptor_heap_mode::descriptor_indexing)
+            setup_descriptor_indexing(pdevice, capacity);
+        else if (mode == descriptor_heap_mode::descriptor_buffer)
+            setup_descriptor_buffer(pdevice, capacity);
+        else
+            throw std::invalid_argument{"descriptor_heap mode"};
+    } catch (...) {
+        release_resources();
+        throw;
+    }
+}
+
+descriptor_heap::~descriptor_heap() noexcept {
+    release_resources();
+}
+
+void descriptor_heap::release_resources() noexcept {
+    if (mapping)
+        device.unmapMemory(memory, dispatch);
+    if (buffer)
+        device.destroyBuffer(buffer, nullptr, dispatch);
+    if (memory)
+        device.freeMemory(memory, nullptr, dispatch);
+    // the set is freed with the pool
+    if (pool)
+        device.destroyDescriptorPool(pool, nullptr, dispatch);
+    if (set_layout)
+        device.destroyDescriptorSetLayout(set_layout, nullptr, dispatch);
+    mapping = nullptr;
+    buffer = nullptr;
+    memory = nullptr;
+    set = nullptr;
+    pool = nullptr;
+    set_layout = nullptr;
+}
+
+void descriptor_heap::setup_descriptor_indexing(vk::PhysicalDevice pdevice, uint32_t capacity) noexcept(false) {
+    check_update_after_bind_capacity(pdevice, dispatch, type, capacity);
+
+    const vk::DescriptorBindingFlags flags =
+        vk::DescriptorBindingFlagBits::eUpdateAfterBind | vk::DescriptorBindingFlagBits::ePartiallyBound;
+    vk::DescriptorSetLayoutBindingFlagsCreateInfo info0{};
+    info0.setBindingFlags(flags);
+
+    vk::DescriptorSetLayoutBinding binding{0, type, capacity, vk::ShaderStageFlagBits::eAll};
+    vk::DescriptorSetLayoutCreateInfo info1{};
+    info1.setPNext(&info0);
+    info1.setFlags(vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool);
+    info1.setBindings(binding);
+    set_layout = device.createDescriptorSetLayout(info1, nullptr, dispatch);
+
+    vk::DescriptorPoolSize size{type, capacity};
+    vk::DescriptorPoolCreateInfo info2{};
+    info2.setFlags(vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind);
+    info2.setMaxSets(1);
+    info2.setPoolSizes(size);
+    pool = device.createDescriptorPool(info2, nullptr, dispatch);
+
+    vk::DescriptorSetAllocateInfo info3{};
+    info3.setDescriptorPool(pool);
+    info3.setSetLayouts(set_layout);
+    set = device.allocateDescriptorSets(info3, dispatch).front();
+}
+
+void descriptor_heap::setup_descriptor_buffer(vk::PhysicalDevice pdevice, uint32_t capacity) noexcept(false) {
+    vk::PhysicalDeviceDescriptorBufferPropertiesEXT props0{};
+    vk::PhysicalDeviceProperties2 props1{};
+    props1.setPNext(&props0);
+    pdevice.getProperties2(&props1, dispatch);
+    check_descriptor_set_capacity(props1.properties.limits, type, capacity);
+    // vkGetDescriptorEXT writes the robust size of buffer descriptors when robustBufferAccess is enabled
+    switch (type) {
+    case vk::DescriptorType::eStorageBuffer:
+        descriptor_size = robust_buffer_access ? props0.robustStorageBufferDescriptorSize
+                                               : props0.storageBufferDescriptorSize;
+        break;
+    case vk::DescriptorType::eUniformBuffer:
+        descriptor_size = robust_buffer_access ? props0.robustUniformBufferDescriptorSize
+                                               : props0.uniformBufferDescriptorSize;
+        break;
+    case vk::DescriptorType::eSampledImage:
+        descriptor_size = props0.sampledImageDescriptorSize;
+        break;
+    default:
+        descriptor_size = props0.storageImageDescriptorSize;
+        break;
+    }
+
+    vk::DescriptorSetLayoutBinding binding{0, type, capacity, vk::ShaderStageFlagBits::eAll};
+    vk::DescriptorSetLayoutCreateInfo info0{};
+    info0.setFlags(vk::DescriptorSetLayoutCreateFlagBits::eDescriptorBufferEXT);
+    info0.setBindings(binding);
+    set_layout = device.createDescriptorSetLayout(info0, nullptr, dispatch);
+    binding_offset = device.getDescriptorSetLayoutBindingOffsetEXT(set_layout, 0, dispatch);
+    const vk::DeviceSize size = device.getDescriptorSetLayoutSizeEXT(set_layout, dispatch);
+    if (size > props0.maxResourceDescriptorBufferRange)
+        throw std::invalid_argument{"descriptor_heap capacity exceeds maxResourceDescriptorBufferRange"};
+
+    buffer_usage = vk::BufferUsageFlagBits::eResourceDescriptorBufferEXT | vk::BufferUsageFlagBits::eShaderDeviceAddress;
+    vk::BufferCreateInfo info1{};
+    info1.setSize(size);
+    info1.setUsage(buffer_usage);
+    info1.setSharingMode(vk::SharingMode::eExclusive);
+    buffer = device.createBuffer(info1, nullptr, dispatch);
+
+    vk::MemoryRequirements reqs = device.getBufferMemoryRequirements(buffer, dispatch);
+    vk::MemoryAllocateFlagsInfo info2{vk::MemoryAllocateFlagBits::eDeviceAddress};
+    vk::MemoryAllocateInfo info3{};
+    info3.setPNext(&info2);
+    info3.setAllocationSize(reqs.size);
+    info3.setMemoryTypeIndex(find_memory_type(pdevice, dispatch, reqs.memoryTypeBits,
+                                              vk::MemoryPropertyFlagBits::eHostVisible |
+                                                  vk::MemoryPropertyFlagBits::eHostCoherent));
+    memory = device.allocateMemory(info3, nullptr, dispatch);
+    device.bindBufferMemory(buffer, memory, 0, dispatch);
+
+    // persistently mapped. each write touches its own slot
+    mapping = static_cast<std::byte *>(device.mapMemory(memory, 0, VK_WHOLE_SIZE, {}, dispatch));
+    address = device.getBufferAddress(vk::BufferDeviceAddressInfo{buffer}, dispatch);
+}
+
+descriptor_heap_mode descriptor_heap::get_mode() const noexcept {
+    return mode;
+}
+
+vk::DescriptorType descriptor_heap::get_type() const noexcept {
+    return type;
+}
+
+uint32_t descriptor_heap::get_capacity() const noexcept {
+    return slots.get_capacity();
+}
+
+vk::DescriptorSetLayout descriptor_heap::get_set_layout() const noexcept {
+    return set_layout;
+}
+
+uint32_t descriptor_heap::allocate() noexcept {
+    return slots.allocate();
+}
+
+bool descriptor_heap::release(uint32_t slot, uint64_t fence_value) noexcept {
+    return slots.release(slot, fence_value);
+}
+
+uint32_t descriptor_heap::collect(uint64_t completed) noexcept {
+    return slots.collect(completed);
+}
+
+uint32_t descriptor_heap::collect(vk::Semaphore timeline) noexcept(false) {
+    return slots.collect(device.getSemaphoreCounterValue(timeline, dispatch));
+}
+
+void descriptor_heap::write(uint32_t slot, const vk::DescriptorBufferInfo &info) noexcept(false) {
+    if (slot >= slots.get_capacity())
+        throw std::out_of_range{"descriptor_heap slot"};
+    if (type != vk::DescriptorType::eStorageBuffer && type != vk::DescriptorType::eUniformBuffer)
+        throw std::invalid_argument{"descriptor_heap type is not a buffer"};
+
+    if (mode == descriptor_heap_mode::descriptor_buffer) {
+        if (info.range == VK_WHOLE_SIZE)
+            throw std::invalid_argument{"descriptor_heap requires explicit buffer range"};
+        vk::DescriptorAddressInfoEXT range{};
+        range.setAddress(device.getBufferAddress(vk::BufferDeviceAddressInfo{info.buffer}, dispatch) + info.offset);
+        range.setRange(info.range);
+        vk::DescriptorGetInfoEXT desc{};
+        desc.setType(type);
+        if (type == vk::DescriptorType::eStorageBuffer)
+            desc.data.setPStorageBuffer(&range);
+        else
+            desc.data.setPUniformBuffer(&range);
+        device.getDescriptorEXT(&desc, descriptor_size, mapping + binding_offset + slot * descriptor_size, dispatch);
+        return;
+    }
+    vk::WriteDescriptorSet write{};
+    write.setDstSet(set);
+    write.setDstBinding(0);
+    write.setDstArrayElement(slot);
+    write.setDescriptorType(type);
+    write.setBufferInfo(info);
+    std::lock_guard lck{update_mtx};
+    device.updateDescriptorSets(write, nullptr, dispatch);
+}
+
+void descriptor_heap::write(uint32_t slot, const vk::DescriptorImageInfo &info) noexcept(false) {
+    if (slot >= slots.get_capacity())
+        throw std::out_of_range{"descriptor_heap slot"};
+    if (type != vk::DescriptorType::eSampledImage && type != vk::DescriptorType::eStorageImage)
+        throw std::invalid_argument{"descriptor_heap type is not an image"};
+
+    if (mode == descriptor_heap_mode::descriptor_buffer) {
+        vk::DescriptorGetInfoEXT desc{};
+        desc.setType(type);
+        if (type == vk::DescriptorType::eSampledImage)
+            desc.data.setPSampledImage(&info);
+        else
+            desc.data.setPStorageImage(&info);
+        device.getDescriptorEXT(&desc, descriptor_size, mapping + binding_offset + slot * descriptor_size, dispatch);
+        return;
+    }
+    vk::WriteDescriptorSet write{};
+    write.setDstSet(set);
+    write.setDstBinding(0);
+    write.setDstArrayElement(slot);
+    write.setDescriptorType(type);
+    write.setImageInfo(info);
+    std::lock_guard lck{update_mtx};
+    device.updateDescriptorSets(write, nullptr, dispatch);
+}
+
+void descriptor_heap::record_bind(vk::CommandBuffer cmd, vk::PipelineBindPoint bind_point, vk::PipelineLayout layout,
+                                  uint32_t set_index) noexcept {
+    if (mode == descriptor_heap_mode::descriptor_buffer) {
+        const vk::DescriptorBufferBindingInfoEXT binding{address, buffer_usage};
+        const uint32_t buffer_index = 0;
+        const vk::DeviceSize offset = 0;
+        cmd.bindDescriptorBuffersEXT(binding, dispatch);
+        cmd.setDescriptorBufferOffsetsEXT(bind_point, layout, set_index, buffer_index, offset, dispatch);
+        return;
+    }
+    cmd.bindDescriptorSets(bind_point, layout, set_index, set, nullptr, dispatch);
+}
+
+} // namespace experiment
@@ -0,0 +1,144 @@
+#pragma once
+#include "experiment.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+#include <vulkan/vulkan.hpp>
+
+namespace experiment {
+
+/// @brief Lock-free allocator of descriptor array indices.
+/// @details Released slots are not reused until the GPU work which may read them is complete.
+///          The gate is a timeline value(`vk::Semaphore` of `vk::SemaphoreType::eTimeline`) given to `release`,
+///          and `collect` moves every slot whose value is already reached back to the free list.
+///          All member functions can be used concurrently. Each slot must be released once per `allocate`;
+///          `release` rejects slots which are not allocated.
+/// @note    The member functions are exported instead of the class, which has STL members(C4251)
+class descriptor_slot_allocator final {
+  public:
+    static constexpr uint32_t invalid = UINT32_MAX;
+
+  private:
+    uint32_t capacity;
+    std::atomic_uint32_t bump{0};
+    std::atomic_uint64_t free_head;    // (tag << 32) | slot
+    std::atomic_uint64_t retired_head; // (tag << 32) | slot
+    std::unique_ptr<std::atomic_uint32_t[]> next;
+    std::unique_ptr<std::atomic_uint64_t[]> retire_values;
+    std::unique_ptr<std::atomic_uint32_t[]> states; // free, allocated, retired
+
+  public:
+    _INTERFACE_ explicit descriptor_slot_allocator(uint32_t capacity) noexcept(false);
+    descriptor_slot_allocator(const descriptor_slot_allocator &) = delete;
+    descriptor_slot_allocator(descriptor_slot_allocator &&) = delete;
+    descriptor_slot_allocator &operator=(const descriptor_slot_allocator &) = delete;
+    descriptor_slot_allocator &operator=(descriptor_slot_allocator &&) = delete;
+
+    _INTERFACE_ uint32_t get_capacity() const noexcept;
+
+    /// @return `invalid` if there is no available slot
+    _INTERFACE_ uint32_t allocate() noexcept;
+
+    /// @param fence_value timeline value after which the GPU doesn't access the slot anymore
+    /// @return false if the slot is not allocated. e.g. released twice
+    _INTERFACE_ bool release(uint32_t slot, uint64_t fence_value) noexcept;
+
+    /// @param completed timeline value the GPU has reached
+    /// @return number of slots which became available
+    _INTERFACE_ uint32_t collect(uint64_t completed) noexcept;
+
+  private:
+    void push(std::atomic_uint64_t &head, uint32_t slot) noexcept;
+    uint32_t pop(std::atomic_uint64_t &head) noexcept;
+};
+
+enum class descriptor_heap_mode : uint32_t {
+    none = 0,
+    descriptor_indexing = 1, // VK_EXT_descriptor_indexing with update-after-bind
+    descriptor_buffer = 2,   // VK_EXT_descriptor_buffer
+};
+
+/// @brief Select the mode of `descriptor_heap` for the descriptor type.
+///        `descriptor_indexing` is preferred, `descriptor_buffer` is used when the other is not available
+/// @note  The device must be created with the features of the returned mode enabled.
+///        `descriptor_indexing`: runtimeDescriptorArray, descriptorBindingPartiallyBound and
+///        descriptorBinding*UpdateAfterBind of the type.
+///        `descriptor_buffer`: descriptorBuffer and bufferDeviceAddress
+_INTERFACE_ descriptor_heap_mode query_descriptor_heap_mode(vk::PhysicalDevice pdevice,
+                                                            const vk::DispatchLoaderDynamic &dispatch,
+                                                            vk::DescriptorType type) noexcept;
+
+/// @brief Bindless descriptor array of one descriptor type. Shaders index it with the slot number.
+/// @details The array is a single binding(0) of `capacity` descriptors in `get_set_layout()`.
+///          Slots are handed out by `descriptor_slot_allocator`, and `write` can be called from multiple threads.
+///          In `descriptor_indexing` mode `vkUpdateDescriptorSets` is serialized because the set is shared.
+///          In `descriptor_buffer` mode the descriptors are written to the mapped buffer without locking.
+/// @note    In `descriptor_buffer` mode, pipelines must be created with
+///          `vk::PipelineCreateFlagBits::eDescriptorBufferEXT`, buffers for `write` must have
+///          `vk::BufferUsageFlagBits::eShaderDeviceAddress` and a range other than `VK_WHOLE_SIZE`.
+///          The member functions are exported instead of the class(C4251)
+class descriptor_heap final {
+    vk::Device device;
+    const vk::DispatchLoaderDynamic &dispatch;
+    descriptor_heap_mode mode;
+    vk::DescriptorType type;
+    bool robust_buffer_access;
+    descriptor_slot_allocator slots;
+    vk::DescriptorSetLayout set_layout{};
+    // descriptor_indexing
+    vk::DescriptorPool pool{};
+    vk::DescriptorSet set{};
+    std::mutex update_mtx{};
+    // descriptor_buffer
+    vk::Buffer buffer{};
+    vk::DeviceMemory memory{};
+    vk::DeviceAddress address = 0;
+    vk::BufferUsageFlags buffer_usage{};
+    std::byte *mapping = nullptr;
+    vk::DeviceSize binding_offset = 0;
+    size_t descriptor_size = 0;
+
+  public:
+    /// @param robust_buffer_access must match robustBufferAccess enabled on the `device`
+    /// @throw std::invalid_argument if `capacity` exceeds the device limits of the mode
+    _INTERFACE_ descriptor_heap(vk::PhysicalDevice pdevice, vk::Device device,
+                                const vk::DispatchLoaderDynamic &dispatch, descriptor_heap_mode mode,
+                                vk::DescriptorType type, uint32_t capacity,
+                                bool robust_buffer_access = false) noexcept(false);
+    _INTERFACE_ ~descriptor_heap() noexcept;
+    descriptor_heap(const descriptor_heap &) = delete;
+    descriptor_heap(descriptor_heap &&) = delete;
+    descriptor_heap &operator=(const descriptor_heap &) = delete;
+    descriptor_heap &operator=(descriptor_heap &&) = delete;
+
+    _INTERFACE_ descriptor_heap_mode get_mode() const noexcept;
+    _INTERFACE_ vk::DescriptorType get_type() const noexcept;
+    _INTERFACE_ uint32_t get_capacity() const noexcept;
+    _INTERFACE_ vk::DescriptorSetLayout get_set_layout() const noexcept;
+
+    /// @see descriptor_slot_allocator
+    _INTERFACE_ uint32_t allocate() noexcept;
+    _INTERFACE_ bool release(uint32_t slot, uint64_t fence_value) noexcept;
+    _INTERFACE_ uint32_t collect(uint64_t completed) noexcept;
+    _INTERFACE_ uint32_t collect(vk::Semaphore timeline) noexcept(false);
+
+    /// @note for storage/uniform buffers
+    _INTERFACE_ void write(uint32_t slot, const vk::DescriptorBufferInfo &info) noexcept(false);
+    /// @note for sampled/storage images
+    _INTERFACE_ void write(uint32_t slot, const vk::DescriptorImageInfo &info) noexcept(false);
+
+    /// @brief Bind the heap as the set `set_index` of the `layout`
+    /// @note  In `descriptor_buffer` mode, this replaces all descriptor buffers bound to the `cmd`
+    _INTERFACE_ void record_bind(vk::CommandBuffer cmd, vk::PipelineBindPoint bind_point, vk::PipelineLayout layout,
+                                 uint32_t set_index) noexcept;
+
+  private:
+    void setup_descriptor_indexing(vk::PhysicalDevice pdevice, uint32_t capacity) noexcept(false);
+    void setup_descriptor_buffer(vk::PhysicalDevice pdevice, uint32_t capacity) noexcept(false);
+    void release_resources() noexcept;
+};
+
+} // namespace experiment
@@ -0,0 +1,194 @@
+#include "kernel_registry.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+
+// generated by glslangValidator. see meson.build
+#include "transform_generic.spv.h"
+#include "transform_specialized.spv.h"
+
+namespace experiment {
+
+/// @see layout(push_constant) in src/kernels/transform.comp
+struct kernel_push_constants final {
+    uint32_t count;
+    uint32_t element_type;
+    uint32_t vector_width;
+    uint32_t operation;
+};
+
+/// @see layout(constant_id) in src/kernels/transform.comp
+struct kernel_specialization final {
+    uint32_t workgroup_size;
+    uint32_t element_type;
+    uint32_t vector_width;
+    uint32_t operation;
+};
+
+static vk::ShaderModule make_shader_module(vk::Device device, const vk::DispatchLoaderDynamic &dispatch,
+                                           std::span<const uint32_t> code) noexcept(false) {
+    vk::ShaderModuleCreateInfo info{};
+    info.setCode(code);
+    return device.createShaderModule(info, nullptr, dispatch);
+}
+
+kernel_registry::kernel_registry(vk::PhysicalDevice pdevice, vk::Device _device,
+                                 const vk::DispatchLoaderDynamic &_dispatch) noexcept(false)
+    : device{_device}, dispatch{_dispatch} {
+    const vk::PhysicalDeviceLimits limits = pdevice.getProperties(dispatch).limits;
+    max_group_count = limits.maxComputeWorkGroupCount[0];
+    max_workgroup_size = std::min(limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations);
+    try {
+        std::array<vk::DescriptorSetLayoutBinding, 3> bindings{};
+        for (uint32_t i = 0; i < bindings.size(); ++i) {
+            bindings[i].setBinding(i);
+            bindings[i].setDescriptorType(vk::DescriptorType::eStorageBuffer);
+            bindings[i].setDescriptorCount(1);
+            bindings[i].setStageFlags(vk::ShaderStageFlagBits::eCompute);
+        }
+        vk::DescriptorSetLayoutCreateInfo info0{};
+        info0.setBindings(bindings);
+        set_layout = device.createDescriptorSetLayout(info0, nullptr, dispatch);
+
+        vk::PushConstantRange range{vk::ShaderStageFlagBits::eCompute, 0, sizeof(kernel_push_constants)};
+        vk::PipelineLayoutCreateInfo info1{};
+        info1.setSetLayouts(set_layout);
+        info1.setPushConstantRanges(range);
+        pipeline_layout = device.createPipelineLayout(info1, nullptr, dispatch);
+
+        pipeline_cache = device.createPipelineCache(vk::PipelineCacheCreateInfo{}, nullptr, dispatch);
+        specialized_module = make_shader_module(device, dispatch, transform_specialized_spv);
+        generic_module = make_shader_module(device, dispatch, transform_generic_spv);
+    } catch (const vk::SystemError &) {
+        release();
+        throw;
+    }
+}
+
+kernel_registry::~kernel_registry() noexcept {
+    release();
+}
+
+void kernel_registry::release() noexcept {
+    for (auto &[key, pipeline] : pipelines)
+        device.destroyPipeline(pipeline, nullptr, dispatch);
+    pipelines.clear();
+    if (generic_pipeline)
+        device.destroyPipeline(generic_pipeline, nullptr, dispatch);
+    if (generic_module)
+        device.destroyShaderModule(generic_module, nullptr, dispatch);
+    if (specialized_module)
+        device.destroyShaderModule(specialized_module, nullptr, dispatch);
+    if (pipeline_cache)
+        device.destroyPipelineCache(pipeline_cache, nullptr, dispatch);
+    if (pipeline_layout)
+        device.destroyPipelineLayout(pipeline_layout, nullptr, dispatch);
+    if (set_layout)
+        device.destroyDescriptorSetLayout(set_layout, nullptr, dispatch);
+    generic_pipeline = nullptr;
+    generic_module = specialized_module = nullptr;
+    pipeline_cache = nullptr;
+    pipeline_layout = nullptr;
+    set_layout = nullptr;
+}
+
+vk::DescriptorSetLayout kernel_registry::get_set_layout() const noexcept {
+    return set_layout;
+}
+
+vk::PipelineLayout kernel_registry::get_pipeline_layout() const noexcept {
+    return pipeline_layout;
+}
+
+size_t kernel_registry::size() noexcept {
+    std::lock_guard lck{mtx};
+    return pipelines.size();
+}
+
+vk::Pipeline kernel_registry::create(vk::ShaderModule module,
+                                     const vk::SpecializationInfo *specialization) noexcept(false) {
+    vk::PipelineShaderStageCreateInfo stage{};
+    stage.setStage(vk::ShaderStageFlagBits::eCompute);
+    stage.setModule(module);
+    stage.setPName("main");
+    stage.setPSpecializationInfo(specialization);
+
+    vk::ComputePipelineCreateInfo info{};
+    info.setStage(stage);
+    info.setLayout(pipeline_layout);
+    auto [result, pipeline] = device.createComputePipeline(pipeline_cache, info, nullptr, dispatch);
+    if (result != vk::Result::eSuccess)
+        throw vk::SystemError{vk::make_error_code(result), "vkCreateComputePipelines"};
+    return pipeline;
+}
+
+/// @see kernel_variant
+void kernel_registry::validate(const kernel_key &key) const noexcept(false) {
+    if (key.element_type > kernel_element<uint32_t>::id)
+        throw std::invalid_argument{"kernel_key element_type"};
+    if (key.vector_width != 1 && key.vector_width != 2 && key.vector_width != 4)
+        throw std::invalid_argument{"kernel_key vector_width"};
+    if (key.workgroup_size == 0 || key.workgroup_size > 1024 || key.workgroup_size > max_workgroup_size)
+        throw std::invalid_argument{"kernel_key workgroup_size"};
+    if (key.op != kernel_op::add && key.op != kernel_op::multiply)
+        throw std::invalid_argument{"kernel_key op"};
+}
+
+vk::Pipeline kernel_registry::get(const kernel_key &key) noexcept(false) {
+    validate(key);
+    std::lock_guard lck{mtx};
+    if (auto it = pipelines.find(key); it != pipelines.end())
+        return it->second;
+
+    const kernel_specialization values{key.workgroup_size, key.element_type, key.vector_width,
+                                       static_cast<uint32_t>(key.op)};
+    const std::array<vk::SpecializationMapEntry, 4> entries{
+        vk::SpecializationMapEntry{0, offsetof(kernel_specialization, workgroup_size), sizeof(uint32_t)},
+        vk::SpecializationMapEntry{1, offsetof(kernel_specialization, element_type), sizeof(uint32_t)},
+        vk::SpecializationMapEntry{2, offsetof(kernel_specialization, vector_width), sizeof(uint32_t)},
+        vk::SpecializationMapEntry{3, offsetof(kernel_specialization, operation), sizeof(uint32_t)},
+    };
+    vk::SpecializationInfo info{};
+    info.setMapEntries(entries);
+    info.setDataSize(sizeof(values));
+    info.setPData(&values);
+
+    vk::Pipeline pipeline = create(specialized_module, &info);
+    pipelines.emplace(key, pipeline);
+    return pipeline;
+}
+
+vk::Pipeline kernel_registry::get_generic() noexcept(false) {
+    std::lock_guard lck{mtx};
+    if (generic_pipeline == nullptr)
+        generic_pipeline = create(generic_module, nullptr);
+    return generic_pipeline;
+}
+
+void kernel_registry::record_generic(vk::CommandBuffer cmd, vk::DescriptorSet set, const kernel_key &key,
+                                     uint32_t count) noexcept(false) {
+    // the generic kernel can't change its workgroup size at runtime
+    kernel_key actual = key;
+    actual.workgroup_size = generic_workgroup_size;
+    validate(actual);
+    record_dispatch(cmd, get_generic(), set, actual, count, actual.vector_width * generic_workgroup_size);
+}
+
+void kernel_registry::record_dispatch(vk::CommandBuffer cmd, vk::Pipeline pipeline, vk::DescriptorSet set,
+                                      const kernel_key &key, uint32_t count,
+                                      uint32_t elements_per_group) noexcept(false) {
+    const uint64_t group_count = (uint64_t{count} + elements_per_group - 1) / elements_per_group;
+    if (group_count > max_group_count)
+        throw std::invalid_argument{"kernel dispatch exceeds maxComputeWorkGroupCount"};
+    const kernel_push_constants constants{count, key.element_type, key.vector_width, static_cast<uint32_t>(key.op)};
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline, dispatch);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline_layout, 0, set, nullptr, dispatch);
+    cmd.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants), &constants, dispatch);
+    cmd.dispatch(static_cast<uint32_t>(group_count), 1, 1, dispatch);
+}
+
+} // namespace experiment
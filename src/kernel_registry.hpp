@@ -0,0 +1,121 @@
+#pragma once
+#include "experiment.hpp"
+
+#include <compare>
+#include <map>
+#include <mutex>
+
+#include <vulkan/vulkan.hpp>
+
+namespace experiment {
+
+/// @see src/kernels/transform.comp
+enum class kernel_op : uint32_t {
+    add = 0,
+    multiply = 1,
+};
+
+template <typename T> struct kernel_element;
+template <> struct kernel_element<float> {
+    static constexpr uint32_t id = 0;
+};
+template <> struct kernel_element<int32_t> {
+    static constexpr uint32_t id = 1;
+};
+template <> struct kernel_element<uint32_t> {
+    static constexpr uint32_t id = 2;
+};
+
+/// @brief Runtime identity of a transform kernel variant
+struct kernel_key final {
+    uint32_t element_type = kernel_element<float>::id;
+    uint32_t vector_width = 1;
+    uint32_t workgroup_size = 64;
+    kernel_op op = kernel_op::add;
+
+    auto operator<=>(const kernel_key &) const = default;
+};
+
+/// @brief Compile-time selection of a specialized transform kernel
+/// @code
+/// using variant_t = kernel_variant<float, 4, 64, kernel_op::multiply>;
+/// registry.record<variant_t>(cmd, set, count);
+/// @endcode
+template <typename T, uint32_t VectorWidth, uint32_t WorkgroupSize, kernel_op Op = kernel_op::add>
+struct kernel_variant final {
+    static_assert(VectorWidth == 1 || VectorWidth == 2 || VectorWidth == 4, "vector width must be 1, 2 or 4");
+    static_assert(WorkgroupSize > 0 && WorkgroupSize <= 1024, "workgroup size must be in (0, 1024]");
+
+    using element_type = T;
+    static constexpr kernel_key key{kernel_element<T>::id, VectorWidth, WorkgroupSize, Op};
+    static constexpr uint32_t elements_per_group = VectorWidth * WorkgroupSize;
+};
+
+/// @brief Lazily creates and caches compute pipelines of the transform kernel for one `vk::Device`.
+/// @details Specialized pipelines are built from SPIR-V specialization constants on first use of each `kernel_key`.
+///          The generic pipeline reads the same parameters from push constants instead.
+///          Bindings of the descriptor set: 0 = input a, 1 = input b, 2 = output c (storage buffers)
+/// @note    The member functions are exported instead of the class, which has STL members(C4251)
+class kernel_registry final {
+    vk::Device device;
+    const vk::DispatchLoaderDynamic &dispatch;
+    uint32_t max_group_count = 0;    // maxComputeWorkGroupCount[0]
+    uint32_t max_workgroup_size = 0; // min(maxComputeWorkGroupSize[0], maxComputeWorkGroupInvocations)
+    vk::DescriptorSetLayout set_layout{};
+    vk::PipelineLayout pipeline_layout{};
+    vk::PipelineCache pipeline_cache{};
+    vk::ShaderModule specialized_module{};
+    vk::ShaderModule generic_module{};
+    vk::Pipeline generic_pipeline{};
+    std::mutex mtx{};
+    std::map<kernel_key, vk::Pipeline> pipelines{};
+
+  public:
+    static constexpr uint32_t generic_workgroup_size = 64;
+
+  public:
+    _INTERFACE_ kernel_registry(vk::PhysicalDevice pdevice, vk::Device device,
+                                const vk::DispatchLoaderDynamic &dispatch) noexcept(false);
+    _INTERFACE_ ~kernel_registry() noexcept;
+    kernel_registry(const kernel_registry &) = delete;
+    kernel_registry(kernel_registry &&) = delete;
+    kernel_registry &operator=(const kernel_registry &) = delete;
+    kernel_registry &operator=(kernel_registry &&) = delete;
+
+    _INTERFACE_ vk::DescriptorSetLayout get_set_layout() const noexcept;
+    _INTERFACE_ vk::PipelineLayout get_pipeline_layout() const noexcept;
+
+    /// @return number of specialized pipelines created so far
+    _INTERFACE_ size_t size() noexcept;
+
+    /// @throw std::invalid_argument if the key is out of the `kernel_variant`'s range or the device limits
+    _INTERFACE_ vk::Pipeline get(const kernel_key &key) noexcept(false);
+    _INTERFACE_ vk::Pipeline get_generic() noexcept(false);
+
+    template <typename Variant> vk::Pipeline get() noexcept(false) {
+        return get(Variant::key);
+    }
+
+    /// @brief Record a dispatch of the specialized pipeline. The descriptor set must use `get_set_layout()`
+    /// @throw std::invalid_argument if `count` exceeds maxComputeWorkGroupCount
+    template <typename Variant>
+    void record(vk::CommandBuffer cmd, vk::DescriptorSet set, uint32_t count) noexcept(false) {
+        record_dispatch(cmd, get<Variant>(), set, Variant::key, count, Variant::elements_per_group);
+    }
+
+    /// @brief Record a dispatch of the generic pipeline, which branches on `key` at runtime
+    /// @throw std::invalid_argument if the key is invalid or `count` exceeds maxComputeWorkGroupCount
+    _INTERFACE_ void record_generic(vk::CommandBuffer cmd, vk::DescriptorSet set, const kernel_key &key,
+                                    uint32_t count) noexcept(false);
+
+  private:
+    void release() noexcept;
+    void validate(const kernel_key &key) const noexcept(false);
+    vk::Pipeline create(vk::ShaderModule module, const vk::SpecializationInfo *info) noexcept(false);
+    // used by `record`, which is inlined in the callers
+    _INTERFACE_ void record_dispatch(vk::CommandBuffer cmd, vk::Pipeline pipeline, vk::DescriptorSet set,
+                                     const kernel_key &key, uint32_t count,
+                                     uint32_t elements_per_group) noexcept(false);
+};
+
+} // namespace experiment
@@ -0,0 +1,652 @@
+#include "streaming_buffer.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+namespace experiment {
+
+page_table::page_table(uint32_t virtual_count, uint32_t physical_count) noexcept(false)
+    : physical_pages(virtual_count, invalid), virtual_pages(physical_count, invalid), pins(physical_count, 0),
+      referenced(physical_count, false), loading(physical_count, false) {
+    if (virtual_count == 0 || virtual_count == invalid || physical_count == 0 || physical_count == invalid)
+        throw std::invalid_argument{"page_table page count"};
+}
+
+uint32_t page_table::get_virtual_count() const noexcept {
+    return static_cast<uint32_t>(physical_pages.size());
+}
+
+uint32_t page_table::get_physical_count() const noexcept {
+    return static_cast<uint32_t>(virtual_pages.size());
+}
+
+uint32_t page_table::get_loading_count() const noexcept {
+    return static_cast<uint32_t>(std::count(loading.begin(), loading.end(), true));
+}
+
+uint32_t page_table::find(uint32_t vpage) const noexcept {
+    if (vpage >= physical_pages.size())
+        return invalid;
+    return physical_pages[vpage];
+}
+
+uint32_t page_table::map(uint32_t vpage, uint32_t &evicted) noexcept {
+    evicted = invalid;
+    if (vpage >= physical_pages.size())
+        return invalid;
+    if (physical_pages[vpage] != invalid)
+        return physical_pages[vpage];
+
+    const uint32_t count = get_physical_count();
+    // free pages are used before any eviction
+    for (uint32_t ppage = 0; ppage < count; ++ppage) {
+        if (virtual_pages[ppage] != invalid)
+            continue;
+        assign(vpage, ppage);
+        return ppage;
+    }
+    // the first round may only clear the reference bits
+    for (uint32_t step = 0; step < 2 * count; ++step) {
+        const uint32_t ppage = hand;
+        hand = (hand + 1) % count;
+        if (pins[ppage] > 0 || loading[ppage])
+            continue;
+        if (referenced[ppage]) {
+            referenced[ppage] = false;
+            continue;
+        }
+        evicted = virtual_pages[ppage];
+        physical_pages[evicted] = invalid;
+        assign(vpage, ppage);
+        return ppage;
+    }
+    return invalid;
+}
+
+void page_table::assign(uint32_t vpage, uint32_t ppage) noexcept {
+    virtual_pages[ppage] = vpage;
+    physical_pages[vpage] = ppage;
+    referenced[ppage] = true;
+    loading[ppage] = true;
+}
+
+void page_table::unmap(uint32_t vpage) noexcept {
+    if (uint32_t ppage = find(vpage); ppage != invalid) {
+        virtual_pages[ppage] = invalid;
+        physical_pages[vpage] = invalid;
+        pins[ppage] = 0;
+        referenced[ppage] = false;
+        loading[ppage] = false;
+    }
+}
+
+void page_table::finish(uint32_t vpage) noexcept {
+    if (uint32_t ppage = find(vpage); ppage != invalid)
+        loading[ppage] = false;
+}
+
+bool page_table::is_loading(uint32_t vpage) const noexcept {
+    if (uint32_t ppage = find(vpage); ppage != invalid)
+        return loading[ppage];
+    return false;
+}
+
+void page_table::pin(uint32_t vpage) noexcept {
+    if (uint32_t ppage = find(vpage); ppage != invalid) {
+        pins[ppage] += 1;
+        referenced[ppage] = true;
+    }
+}
+
+void page_table::unpin(uint32_t vpage) noexcept {
+    if (uint32_t ppage = find(vpage); ppage != invalid && pins[ppage] > 0)
+        pins[ppage] -= 1;
+}
+
+/// @note prefer the `preferred` flags, then any type which has `required` flags
+static uint32_t find_memory_type(vk::PhysicalDevice pdevice, const vk::DispatchLoaderDynamic &dispatch,
+                                 uint32_t requirement, vk::MemoryPropertyFlags preferred,
+                                 vk::MemoryPropertyFlags required) noexcept(false) {
+    vk::PhysicalDeviceMemoryProperties physical = pdevice.getMemoryProperties(dispatch);
+    for (auto flags : {preferred | required, required}) {
+        for (uint32_t index = 0; index < physical.memoryTypeCount; ++index) {
+            const uint32_t type_bits = (1 << index);
+            if ((requirement & type_bits) && (physical.memoryTypes[index].propertyFlags & flags) == flags)
+                return index;
+        }
+    }
+    throw std::runtime_error{"device memory property not found"};
+}
+
+static uint32_t count_pages(vk::DeviceSize size, vk::DeviceSize page_size) noexcept(false) {
+    const vk::DeviceSize count = (size + page_size - 1) / page_size;
+    if (count >= page_table::invalid)
+        throw std::out_of_range{"streaming_buffer page count"};
+    return static_cast<uint32_t>(count);
+}
+
+streaming_buffer_mode query_streaming_buffer_mode(vk::PhysicalDevice pdevice, const vk::DispatchLoaderDynamic &dispatch,
+                                                  uint32_t queue_family) noexcept(false) {
+    auto props = pdevice.getQueueFamilyProperties(dispatch);
+    if (queue_family >= props.size())
+        throw std::invalid_argument{"streaming_buffer queue family"};
+    // graphics and compute queues support transfer implicitly
+    const vk::QueueFlags flags = props[queue_family].queueFlags;
+    if ((flags & (vk::QueueFlagBits::eTransfer | vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)) ==
+        vk::QueueFlags{})
+        throw std::invalid_argument{"streaming_buffer queue family can't transfer"};
+
+    vk::PhysicalDeviceFeatures features = pdevice.getFeatures(dispatch);
+    if (!features.sparseBinding || !features.sparseResidencyBuffer)
+        return streaming_buffer_mode::software;
+    if ((flags & vk::QueueFlagBits::eSparseBinding) == vk::QueueFlags{})
+        return streaming_buffer_mode::software;
+    return streaming_buffer_mode::sparse;
+}
+
+streaming_buffer::streaming_buffer(vk::PhysicalDevice pdevice, vk::Device _device,
+                                   const vk::DispatchLoaderDynamic &_dispatch, streaming_buffer_mode _mode,
+                                   vk::Queue _queue, std::mutex &_queue_mtx, uint32_t queue_family,
+                                   vk::DeviceSize _size, vk::DeviceSize _page_size, uint32_t resident_pages,
+                                   vk::BufferUsageFlags usage, page_loader _loader) noexcept(false)
+    : device{_device}, dispatch{_dispatch}, mode{_mode}, queue{_queue}, queue_mtx{_queue_mtx}, size{_size},
+      page_size{_page_size}, sparse{_mode == streaming_buffer_mode::sparse}, loader{std::move(_loader)} {
+    if (size == 0 || page_size == 0 || resident_pages == 0)
+        throw std::invalid_argument{"streaming_buffer size"};
+    if (loader == nullptr)
+        throw std::invalid_argument{"streaming_buffer loader"};
+    const streaming_buffer_mode supported = query_streaming_buffer_mode(pdevice, dispatch, queue_family);
+    if (mode != streaming_buffer_mode::software && mode != supported)
+        throw std::invalid_argument{"streaming_buffer mode"};
+    try {
+        if (sparse)
+            setup_sparse(pdevice, resident_pages, usage);
+        else
+            setup_software(pdevice, resident_pages, usage);
+        // pages of one batch stay pinned until the upload, so the batch can't be larger than the pool
+        staging_pages = std::min(resident_pages, 4u);
+        setup_upload(pdevice, queue_family, foreground);
+        setup_upload(pdevice, queue_family, background);
+    } catch (...) {
+        release_resources();
+        throw;
+    }
+    worker = std::thread{&streaming_buffer::run_prefetch, this};
+}
+
+streaming_buffer::~streaming_buffer() noexcept {
+    {
+        std::lock_guard lck{request_mtx};
+        stopping = true;
+    }
+    request_cv.notify_all();
+    if (worker.joinable())
+        worker.join();
+    release_resources();
+}
+
+void streaming_buffer::release_upload(upload_context &context) noexcept {
+    if (context.bound)
+        device.destroySemaphore(context.bound, nullptr, dispatch);
+    if (context.fence)
+        device.destroyFence(context.fence, nullptr, dispatch);
+    // the command buffer is freed with the pool
+    if (context.command_pool)
+        device.destroyCommandPool(context.command_pool, nullptr, dispatch);
+    if (context.staging_mapping)
+        device.unmapMemory(context.staging_memory, dispatch);
+    if (context.staging_buffer)
+        device.destroyBuffer(context.staging_buffer, nullptr, dispatch);
+    if (context.staging_memory)
+        device.freeMemory(context.staging_memory, nullptr, dispatch);
+    context.bound = nullptr;
+    context.bound_pending = false;
+    context.fence = nullptr;
+    context.cmd = nullptr;
+    context.command_pool = nullptr;
+    context.staging_mapping = nullptr;
+    context.staging_buffer = nullptr;
+    context.staging_memory = nullptr;
+}
+
+void streaming_buffer::release_resources() noexcept {
+    release_upload(background);
+    release_upload(foreground);
+    if (table_mapping)
+        device.unmapMemory(table_memory, dispatch);
+    if (table_buffer)
+        device.destroyBuffer(table_buffer, nullptr, dispatch);
+    if (table_memory)
+        device.freeMemory(table_memory, nullptr, dispatch);
+    // sparse bindings are released with the buffer
+    if (buffer)
+        device.destroyBuffer(buffer, nullptr, dispatch);
+    if (memory)
+        device.freeMemory(memory, nullptr, dispatch);
+    table_mapping = nullptr;
+    table_buffer = nullptr;
+    table_memory = nullptr;
+    buffer = nullptr;
+    memory = nullptr;
+}
+
+void streaming_buffer::setup_sparse(vk::PhysicalDevice pdevice, uint32_t resident_pages,
+                                    vk::BufferUsageFlags usage) noexcept(false) {
+    vk::BufferCreateInfo info0{};
+    info0.setFlags(vk::BufferCreateFlagBits::eSparseBinding | vk::BufferCreateFlagBits::eSparseResidency);
+    info0.setSize(size);
+    info0.setUsage(usage | vk::BufferUsageFlagBits::eTransferDst);
+    info0.setSharingMode(vk::SharingMode::eExclusive);
+    buffer = device.createBuffer(info0, nullptr, dispatch);
+
+    // the alignment is the sparse block size. pages must be made of whole blocks
+    vk::MemoryRequirements reqs = device.getBufferMemoryRequirements(buffer, dispatch);
+    page_size = (page_size + reqs.alignment - 1) / reqs.alignment * reqs.alignment;
+    // the binding of the last page ends here, not at `size`
+    bind_size = reqs.size;
+    pages = page_table{count_pages(size, page_size), resident_pages};
+
+    vk::MemoryAllocateInfo info1{};
+    info1.setAllocationSize(page_size * resident_pages);
+    info1.setMemoryTypeIndex(
+        find_memory_type(pdevice, dispatch, reqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal, {}));
+    memory = device.allocateMemory(info1, nullptr, dispatch);
+}
+
+void streaming_buffer::setup_software(vk::PhysicalDevice pdevice, uint32_t resident_pages,
+                                      vk::BufferUsageFlags usage) noexcept(false) {
+    pages = page_table{count_pages(size, page_size), resident_pages};
+
+    vk::BufferCreateInfo info0{};
+    info0.setSize(page_size * resident_pages);
+    info0.setUsage(usage | vk::BufferUsageFlagBits::eTransferDst);
+    info0.setSharingMode(vk::SharingMode::eExclusive);
+    buffer = device.createBuffer(info0, nullptr, dispatch);
+    {
+        vk::MemoryRequirements reqs = device.getBufferMemoryRequirements(buffer, dispatch);
+        vk::MemoryAllocateInfo info{};
+        info.setAllocationSize(reqs.size);
+        info.setMemoryTypeIndex(
+            find_memory_type(pdevice, dispatch, reqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal, {}));
+        memory = device.allocateMemory(info, nullptr, dispatch);
+        device.bindBufferMemory(buffer, memory, 0, dispatch);
+    }
+
+    const uint32_t count = pages.get_virtual_count();
+    vk::BufferCreateInfo info1{};
+    info1.setSize(sizeof(uint32_t) * count);
+    info1.setUsage(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc);
+    info1.setSharingMode(vk::SharingMode::eExclusive);
+    table_buffer = device.createBuffer(info1, nullptr, dispatch);
+    {
+        vk::MemoryRequirements reqs = device.getBufferMemoryRequirements(table_buffer, dispatch);
+        vk::MemoryAllocateInfo info{};
+        info.setAllocationSize(reqs.size);
+        info.setMemoryTypeIndex(find_memory_type(
+            pdevice, dispatch, reqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent));
+        table_memory = device.allocateMemory(info, nullptr, dispatch);
+        device.bindBufferMemory(table_buffer, table_memory, 0, dispatch);
+    }
+    table_mapping = static_cast<uint32_t *>(device.mapMemory(table_memory, 0, VK_WHOLE_SIZE, {}, dispatch));
+    std::fill_n(table_mapping, count, page_table::invalid);
+}
+
+void streaming_buffer::setup_upload(vk::PhysicalDevice pdevice, uint32_t queue_family,
+                                    upload_context &context) noexcept(false) {
+    vk::BufferCreateInfo info0{};
+    info0.setSize(page_size * staging_pages);
+    info0.setUsage(vk::BufferUsageFlagBits::eTransferSrc);
+    info0.setSharingMode(vk::SharingMode::eExclusive);
+    context.staging_buffer = device.createBuffer(info0, nullptr, dispatch);
+
+    vk::MemoryRequirements reqs = device.getBufferMemoryRequirements(context.staging_buffer, dispatch);
+    vk::MemoryAllocateInfo info1{};
+    info1.setAllocationSize(reqs.size);
+    info1.setMemoryTypeIndex(find_memory_type(pdevice, dispatch, reqs.memoryTypeBits, {},
+                                              vk::MemoryPropertyFlagBits::eHostVisible |
+                                                  vk::MemoryPropertyFlagBits::eHostCoherent));
+    context.staging_memory = device.allocateMemory(info1, nullptr, dispatch);
+    device.bindBufferMemory(context.staging_buffer, context.staging_memory, 0, dispatch);
+    context.staging_mapping =
+        static_cast<std::byte *>(device.mapMemory(context.staging_memory, 0, VK_WHOLE_SIZE, {}, dispatch));
+
+    vk::CommandPoolCreateInfo info2{vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queue_family};
+    context.command_pool = device.createCommandPool(info2, nullptr, dispatch);
+    vk::CommandBufferAllocateInfo info3{context.command_pool, vk::CommandBufferLevel::ePrimary, 1};
+    context.cmd = device.allocateCommandBuffers(info3, dispatch).front();
+    context.fence = device.createFence(vk::FenceCreateInfo{}, nullptr, dispatch);
+    if (sparse)
+        context.bound = device.createSemaphore(vk::SemaphoreCreateInfo{}, nullptr, dispatch);
+}
+
+streaming_buffer_mode streaming_buffer::get_mode() const noexcept {
+    return mode;
+}
+
+vk::DeviceSize streaming_buffer::get_size() const noexcept {
+    return size;
+}
+
+vk::DeviceSize streaming_buffer::get_page_size() const noexcept {
+    return page_size;
+}
+
+vk::Buffer streaming_buffer::get_buffer() const noexcept {
+    return buffer;
+}
+
+vk::Buffer streaming_buffer::get_page_table_buffer() const noexcept {
+    return table_buffer;
+}
+
+void streaming_buffer::acquire(vk::DeviceSize offset, vk::DeviceSize length) noexcept(false) {
+    if (length == 0)
+        return;
+    if (offset >= size || length > size - offset)
+        throw std::out_of_range{"streaming_buffer range"};
+    const auto first = static_cast<uint32_t>(offset / page_size);
+    const auto last = static_cast<uint32_t>((offset + length - 1) / page_size);
+
+    make_resident(first, last - first + 1, true, foreground);
+    std::unique_lock lck{mtx};
+    // sequential access. load the following pages before they are requested
+    const bool sequential = first == next_sequential || first + 1 == next_sequential;
+    next_sequential = last + 1;
+    const uint32_t distance = prefetch_distance;
+    lck.unlock();
+
+    if (sequential && distance > 0 && last + 1 < pages.get_virtual_count())
+        schedule(last + 1, std::min(distance, pages.get_virtual_count() - (last + 1)));
+}
+
+void streaming_buffer::release(vk::DeviceSize offset, vk::DeviceSize length) noexcept {
+    if (length == 0 || offset >= size || length > size - offset)
+        return;
+    const auto first = static_cast<uint32_t>(offset / page_size);
+    const auto last = static_cast<uint32_t>((offset + length - 1) / page_size);
+
+    std::lock_guard lck{mtx};
+    for (uint32_t vpage = first; vpage <= last; ++vpage)
+        pages.unpin(vpage);
+}
+
+void streaming_buffer::prefetch(vk::DeviceSize offset, vk::DeviceSize length) noexcept(false) {
+    if (length == 0)
+        return;
+    if (offset >= size || length > size - offset)
+        throw std::out_of_range{"streaming_buffer range"};
+    const auto first = static_cast<uint32_t>(offset / page_size);
+    const auto last = static_cast<uint32_t>((offset + length - 1) / page_size);
+    schedule(first, last - first + 1);
+}
+
+void streaming_buffer::set_prefetch_distance(uint32_t count) noexcept {
+    std::lock_guard lck{mtx};
+    prefetch_distance = count;
+}
+
+void streaming_buffer::schedule(uint32_t first, uint32_t count) noexcept(false) {
+    {
+        std::lock_guard lck{request_mtx};
+        requests.emplace_back(first, count);
+    }
+    request_cv.notify_one();
+}
+
+void streaming_buffer::run_prefetch() noexcept {
+    while (true) {
+        std::pair<uint32_t, uint32_t> request{};
+        {
+            std::unique_lock lck{request_mtx};
+            request_cv.wait(lck, [this]() { return stopping || requests.empty() == false; });
+            if (stopping)
+                return;
+            request = requests.front();
+            requests.pop_front();
+        }
+        try {
+            make_resident(request.first, request.second, false, background);
+        } catch (const std::exception &ex) {
+            spdlog::warn("streaming_buffer prefetch: {}", ex.what());
+        }
+    }
+}
+
+vk::DeviceSize streaming_buffer::get_bind_length(uint32_t vpage) const noexcept {
+    // the last page may be smaller than page_size
+    const vk::DeviceSize offset = vpage * page_size;
+    return std::min(page_size, bind_size - offset);
+}
+
+/// @brief Pin the resident pages and load the others with the `context`.
+///        `mtx` is not held while the loader and the transfer run, so the other context can use the page table.
+///        When `pin` is true, it also waits for the pages in loading by the other context
+/// @note  Locks the `context` and `mtx`
+/// @return false if the pool is full of pinned pages. When `pin` is true it throws instead
+bool streaming_buffer::make_resident(uint32_t first, uint32_t count, bool pin,
+                                     upload_context &context) noexcept(false) {
+    // the context is locked only when there is a page to load
+    std::unique_lock upload_lck{context.mtx, std::defer_lock};
+    std::unique_lock lck{mtx};
+    std::vector<uint32_t> targets{};
+    for (uint32_t vpage = first; vpage < first + count; ++vpage)
+        targets.emplace_back(vpage);
+    std::vector<uint32_t> pinned{};   // pins of the caller
+    std::vector<page_upload> batch{}; // pages in loading by this call. `upload` clears it
+    try {
+        while (targets.empty() == false) {
+            for (size_t i = 0; i < targets.size();) {
+                const uint32_t vpage = targets[i];
+                if (pages.find(vpage) != page_table::invalid) {
+                    // the page may be in loading by the other context. see the wait below
+                    if (pin) {
+                        pages.pin(vpage);
+                        pinned.emplace_back(vpage);
+                    }
+                    ++i;
+                    continue;
+                }
+                if (upload_lck.owns_lock() == false) {
+                    // the context is locked before `mtx`. check the page again after it
+                    lck.unlock();
+                    upload_lck.lock();
+                    lck.lock();
+                    continue;
+                }
+                uint32_t evicted = page_table::invalid;
+                const uint32_t ppage = pages.map(vpage, evicted);
+                if (ppage == page_table::invalid) {
+                    if (pin == false) {
+                        upload(lck, context, batch, pin);
+                        return false;
+                    }
+                    // the pages of the batch remain pinned, but the other context may release some
+                    if (batch.empty() == false)
+                        upload(lck, context, batch, pin);
+                    else if (pages.get_loading_count() > 0)
+                        loaded_cv.wait(lck);
+                    else
+                        throw std::runtime_error{"streaming_buffer page pool is full of pinned pages"};
+                    continue;
+                }
+                // pinned while in loading. the pin becomes the caller's if `pin` is true
+                pages.pin(vpage);
+                if (pin)
+                    pinned.emplace_back(vpage);
+                // the physical page will be overwritten. the new page is visible after the upload
+                if (table_mapping && evicted != page_table::invalid)
+                    table_mapping[evicted] = page_table::invalid;
+                batch.emplace_back(page_upload{vpage, ppage, evicted});
+                ++i;
+                if (batch.size() == staging_pages)
+                    upload(lck, context, batch, pin);
+            }
+            upload(lck, context, batch, pin);
+            targets.clear();
+            if (pin == false)
+                break;
+            loaded_cv.wait(lck, [this, &pinned]() {
+                return std::none_of(pinned.begin(), pinned.end(),
+                                    [this](uint32_t vpage) { return pages.is_loading(vpage); });
+            });
+            // the other context failed to load them. their pins are dropped
+            std::erase_if(pinned, [this, &targets](uint32_t vpage) {
+                if (pages.find(vpage) != page_table::invalid)
+                    return false;
+                targets.emplace_back(vpage);
+                return true;
+            });
+        }
+        return true;
+    } catch (...) {
+        if (lck.owns_lock() == false)
+            lck.lock();
+        rollback(context, batch);
+        for (uint32_t vpage : pinned)
+            pages.unpin(vpage);
+        throw;
+    }
+}
+
+/// @brief Load the pages of the batch and publish them. `mtx` is unlocked during the loader and the transfer
+/// @note  `lck` must own `mtx`. The `context` must be locked. The batch is rolled back if this throws
+void streaming_buffer::upload(std::unique_lock<std::mutex> &lck, upload_context &context,
+                              std::vector<page_upload> &batch, bool pin) noexcept(false) {
+    if (batch.empty())
+        return;
+    try {
+        // bindings are changed in the order of the page table changes
+        if (sparse)
+            bind(context, batch);
+        lck.unlock();
+        transfer(context, batch);
+        lck.lock();
+    } catch (...) {
+        if (lck.owns_lock() == false)
+            lck.lock();
+        rollback(context, batch);
+        throw;
+    }
+    for (const page_upload &page : batch) {
+        pages.finish(page.vpage);
+        if (table_mapping)
+            table_mapping[page.vpage] = page.ppage;
+        if (pin == false)
+            pages.unpin(page.vpage);
+    }
+    batch.clear();
+    loaded_cv.notify_all();
+}
+
+/// @brief Bind the pages of the batch and unbind the evicted pages. `context.bound` is signaled after it
+/// @note  `mtx` must be locked
+void streaming_buffer::bind(upload_context &context, std::span<const page_upload> batch) noexcept(false) {
+    std::vector<vk::SparseMemoryBind> binds{};
+    for (const page_upload &page : batch) {
+        if (page.evicted != page_table::invalid)
+            binds.emplace_back(page.evicted * page_size, get_bind_length(page.evicted), nullptr, 0);
+        binds.emplace_back(page.vpage * page_size, get_bind_length(page.vpage), memory, page.ppage * page_size);
+    }
+    vk::SparseBufferMemoryBindInfo info0{buffer, binds};
+    vk::BindSparseInfo info1{};
+    info1.setBufferBinds(info0);
+    info1.setSignalSemaphores(context.bound);
+    std::lock_guard lck{queue_mtx};
+    queue.bindSparse(info1, nullptr, dispatch);
+    context.bound_pending = true;
+}
+
+/// @brief Load the pages into the staging buffer and copy them to the `buffer`
+/// @note  The `context` must be locked. `mtx` is not required
+void streaming_buffer::transfer(upload_context &context, std::span<const page_upload> batch) noexcept(false) {
+    std::vector<vk::BufferCopy> copies{};
+    for (uint32_t i = 0; i < batch.size(); ++i) {
+        const page_upload &page = batch[i];
+        const vk::DeviceSize offset = page.vpage * page_size;
+        const vk::DeviceSize length = std::min(page_size, size - offset);
+        loader(page.vpage,
+               std::span<std::byte>{context.staging_mapping + i * page_size, static_cast<size_t>(length)});
+        const vk::DeviceSize dst_offset = sparse ? offset : page.ppage * page_size;
+        copies.emplace_back(i * page_size, dst_offset, length);
+    }
+
+    vk::CommandBuffer cmd = context.cmd;
+    cmd.reset({}, dispatch);
+    cmd.begin(vk::CommandBufferBeginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit}, dispatch);
+    cmd.copyBuffer(context.staging_buffer, buffer, copies, dispatch);
+    // make the pages visible to the following submissions
+    vk::MemoryBarrier barrier{vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eMemoryRead};
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands, {}, barrier,
+                        nullptr, nullptr, dispatch);
+    cmd.end(dispatch);
+
+    const vk::PipelineStageFlags stage = vk::PipelineStageFlagBits::eTransfer;
+    vk::SubmitInfo info{};
+    info.setCommandBuffers(cmd);
+    if (context.bound_pending) {
+        info.setWaitSemaphores(context.bound);
+        info.setWaitDstStageMask(stage);
+    }
+    {
+        std::lock_guard lck{queue_mtx};
+        queue.submit(info, context.fence, dispatch);
+        context.bound_pending = false;
+    }
+    if (device.waitForFences(context.fence, VK_TRUE, UINT64_MAX, dispatch) != vk::Result::eSuccess)
+        throw std::runtime_error{"vkWaitForFences"};
+    device.resetFences(context.fence, dispatch);
+}
+
+/// @brief The pages of the failed batch must not look resident. The pages evicted for them are already invalid
+/// @note  `mtx` must be locked
+void streaming_buffer::rollback(upload_context &context, std::vector<page_upload> &batch) noexcept {
+    if (batch.empty())
+        return;
+    for (const page_upload &page : batch) {
+        pages.unmap(page.vpage);
+        if (table_mapping)
+            table_mapping[page.vpage] = page_table::invalid;
+    }
+    if (sparse)
+        unbind(context, batch);
+    batch.clear();
+    // the callers waiting for the pages must load them again
+    loaded_cv.notify_all();
+}
+
+/// @brief Remove the bindings of the pages in the failed batch. It also waits for `context.bound` if it is pending
+/// @note  `mtx` must be locked. The pages must be unmapped from `pages`
+void streaming_buffer::unbind(upload_context &context, std::span<const page_upload> batch) noexcept {
+    std::vector<vk::SparseMemoryBind> binds{};
+    for (const page_upload &page : batch) {
+        binds.emplace_back(page.vpage * page_size, get_bind_length(page.vpage), nullptr, 0);
+        // the other context may have bound it again
+        if (page.evicted != page_table::invalid && pages.find(page.evicted) == page_table::invalid)
+            binds.emplace_back(page.evicted * page_size, get_bind_length(page.evicted), nullptr, 0);
+    }
+    try {
+        // the fence may be signaled by the failed submission
+        device.resetFences(context.fence, dispatch);
+        vk::SparseBufferMemoryBindInfo info0{buffer, binds};
+        vk::BindSparseInfo info1{};
+        info1.setBufferBinds(info0);
+        // the binary semaphore must be unsignaled for the next `bind`
+        if (context.bound_pending)
+            info1.setWaitSemaphores(context.bound);
+        {
+            std::lock_guard lck{queue_mtx};
+            queue.bindSparse(info1, context.fence, dispatch);
+            context.bound_pending = false;
+        }
+        if (device.waitForFences(context.fence, VK_TRUE, UINT64_MAX, dispatch) != vk::Result::eSuccess)
+            throw std::runtime_error{"vkWaitForFences"};
+        device.resetFences(context.fence, dispatch);
+    } catch (const std::exception &ex) {
+        spdlog::error("streaming_buffer unbind: {}", ex.what());
+    }
+}
+
+} // namespace experiment
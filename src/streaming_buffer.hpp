@@ -0,0 +1,203 @@
+#pragma once
+#include "experiment.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+namespace experiment {
+
+/// @brief Mapping of virtual pages to a smaller pool of physical pages, with clock(second chance) eviction.
+///        Pinned pages and the pages in loading are never evicted.
+/// @note  Not thread-safe. The member functions are exported instead of the class, which has STL members(C4251)
+class page_table final {
+  public:
+    static constexpr uint32_t invalid = UINT32_MAX;
+
+  private:
+    std::vector<uint32_t> physical_pages; // virtual -> physical
+    std::vector<uint32_t> virtual_pages;  // physical -> virtual
+    std::vector<uint32_t> pins;           // physical
+    std::vector<bool> referenced;         // physical
+    std::vector<bool> loading;            // physical
+    uint32_t hand = 0;
+
+  public:
+    page_table() noexcept = default;
+    _INTERFACE_ page_table(uint32_t virtual_count, uint32_t physical_count) noexcept(false);
+
+    _INTERFACE_ uint32_t get_virtual_count() const noexcept;
+    _INTERFACE_ uint32_t get_physical_count() const noexcept;
+    /// @return number of the pages in loading
+    _INTERFACE_ uint32_t get_loading_count() const noexcept;
+
+    /// @return `invalid` if the page is not resident
+    _INTERFACE_ uint32_t find(uint32_t vpage) const noexcept;
+
+    /// @brief Assign a physical page to the non-resident `vpage`. Free physical pages are used before eviction.
+    ///        The page is in loading until `finish`
+    /// @param evicted the virtual page which lost its physical page, or `invalid`
+    /// @return `invalid` if every physical page is pinned or in loading
+    _INTERFACE_ uint32_t map(uint32_t vpage, uint32_t &evicted) noexcept;
+    /// @brief Make the physical page of `vpage` free. Its pins are dropped
+    _INTERFACE_ void unmap(uint32_t vpage) noexcept;
+    /// @brief The content of `vpage` is ready
+    _INTERFACE_ void finish(uint32_t vpage) noexcept;
+    _INTERFACE_ bool is_loading(uint32_t vpage) const noexcept;
+
+    /// @note `vpage` must be resident. marks the page as recently used
+    _INTERFACE_ void pin(uint32_t vpage) noexcept;
+    _INTERFACE_ void unpin(uint32_t vpage) noexcept;
+
+  private:
+    void assign(uint32_t vpage, uint32_t ppage) noexcept;
+};
+
+enum class streaming_buffer_mode : uint32_t {
+    software = 0, // page pool and page table buffer
+    sparse = 1,   // sparse residency buffer
+};
+
+/// @brief Select the mode of `streaming_buffer` for the queue family.
+///        `sparse` requires sparseBinding, sparseResidencyBuffer and a queue family with `eSparseBinding`
+/// @note  The device must be created with sparseBinding and sparseResidencyBuffer enabled for `sparse`
+/// @throw std::invalid_argument if the queue family can't do transfer
+_INTERFACE_ streaming_buffer_mode query_streaming_buffer_mode(vk::PhysicalDevice pdevice,
+                                                              const vk::DispatchLoaderDynamic &dispatch,
+                                                              uint32_t queue_family) noexcept(false);
+
+/// @brief Buffer of `size` bytes backed by a pool of `resident_pages` fixed-size pages.
+/// @details Pages are loaded on demand by `acquire` and asynchronously by `prefetch`.
+///          Sequential `acquire` calls also prefetch the pages after the acquired range.
+///          When the pool is full, unpinned pages are evicted with `page_table`'s clock policy.
+///
+///          In `streaming_buffer_mode::sparse`, `get_buffer()` spans the whole `size` and resident pages are bound
+///          with `vkQueueBindSparse`. In `streaming_buffer_mode::software`, `get_buffer()` is the page pool itself
+///          and shaders must translate the offsets with `get_page_table_buffer()`. It holds one `uint32_t`
+///          physical page index per virtual page(`page_table::invalid` if not resident).
+/// @note    Pages are loaded in 3 steps. They are mapped and pinned in the `page_table` under `mtx`, uploaded without
+///          it, then published under `mtx` again. `acquire` waits only for the pages in loading.
+///          The `acquire` callers and the prefetch thread have their own staging memory and commands.
+///
+///          The `queue` is also used from the prefetch thread. Every use of it is guarded by `queue_mtx`,
+///          so other users of the queue must lock the same mutex. Don't call the member functions while holding it.
+///          The member functions are exported instead of the class(C4251)
+class streaming_buffer final {
+  public:
+    /// @brief Fill `dst` with the content of the virtual page. `dst` is shorter than the page size for the last page
+    /// @note  It is invoked from the `acquire` callers and the prefetch thread, without any lock of this type
+    using page_loader = std::function<void(uint32_t page, std::span<std::byte> dst)>;
+
+  private:
+    struct page_upload final {
+        uint32_t vpage;
+        uint32_t ppage;
+        uint32_t evicted;
+    };
+    /// @brief Staging memory and commands for the uploads of one thread at a time
+    struct upload_context final {
+        std::mutex mtx{}; // locked before `streaming_buffer::mtx`
+        vk::Buffer staging_buffer{};
+        vk::DeviceMemory staging_memory{};
+        std::byte *staging_mapping = nullptr;
+        vk::CommandPool command_pool{};
+        vk::CommandBuffer cmd{};
+        vk::Fence fence{};
+        vk::Semaphore bound{};     // sparse. signaled by the binding of the batch
+        bool bound_pending = false; // `bound` is signaled and no submission waits for it
+    };
+
+  private:
+    vk::Device device;
+    const vk::DispatchLoaderDynamic &dispatch;
+    streaming_buffer_mode mode;
+    vk::Queue queue;
+    std::mutex &queue_mtx;
+    vk::DeviceSize size;
+    vk::DeviceSize page_size;
+    vk::DeviceSize bind_size = 0; // sparse. `VkMemoryRequirements::size` of the buffer
+    bool sparse;
+    page_loader loader;
+
+    std::mutex mtx{}; // page table. not held during the loader and the transfer
+    std::condition_variable loaded_cv{};
+    page_table pages{};
+    uint32_t prefetch_distance = 4;
+    uint32_t next_sequential = page_table::invalid;
+    vk::Buffer buffer{};
+    vk::DeviceMemory memory{};
+    vk::Buffer table_buffer{};
+    vk::DeviceMemory table_memory{};
+    uint32_t *table_mapping = nullptr;
+    uint32_t staging_pages = 0; // pages of a batch. the staging buffers hold them
+    upload_context foreground{}; // acquire
+    upload_context background{}; // prefetch thread
+
+    std::mutex request_mtx{};
+    std::condition_variable request_cv{};
+    std::deque<std::pair<uint32_t, uint32_t>> requests{}; // first page, page count
+    bool stopping = false;
+    std::thread worker{};
+
+  public:
+    /// @param mode see `query_streaming_buffer_mode`
+    /// @throw std::invalid_argument if the `mode` is not supported with the `queue_family`
+    _INTERFACE_ streaming_buffer(vk::PhysicalDevice pdevice, vk::Device device,
+                                 const vk::DispatchLoaderDynamic &dispatch, streaming_buffer_mode mode,
+                                 vk::Queue queue, std::mutex &queue_mtx, uint32_t queue_family, vk::DeviceSize size,
+                                 vk::DeviceSize page_size, uint32_t resident_pages, vk::BufferUsageFlags usage,
+                                 page_loader loader) noexcept(false);
+    _INTERFACE_ ~streaming_buffer() noexcept;
+    streaming_buffer(const streaming_buffer &) = delete;
+    streaming_buffer(streaming_buffer &&) = delete;
+    streaming_buffer &operator=(const streaming_buffer &) = delete;
+    streaming_buffer &operator=(streaming_buffer &&) = delete;
+
+    _INTERFACE_ streaming_buffer_mode get_mode() const noexcept;
+    _INTERFACE_ vk::DeviceSize get_size() const noexcept;
+    /// @note may be larger than the requested page size to meet the sparse block alignment
+    _INTERFACE_ vk::DeviceSize get_page_size() const noexcept;
+    _INTERFACE_ vk::Buffer get_buffer() const noexcept;
+    /// @return `nullptr` in `streaming_buffer_mode::sparse`
+    /// @note   it can be the source of transfer commands
+    _INTERFACE_ vk::Buffer get_page_table_buffer() const noexcept;
+
+    /// @brief Make the range resident and pin it until `release`.
+    ///        Blocks until the pages are uploaded, including the pages in loading by the prefetch thread
+    /// @throw std::runtime_error if the pool can't hold the range
+    _INTERFACE_ void acquire(vk::DeviceSize offset, vk::DeviceSize length) noexcept(false);
+    /// @brief Allow eviction of the range. The GPU work which uses the range must be complete
+    _INTERFACE_ void release(vk::DeviceSize offset, vk::DeviceSize length) noexcept;
+    /// @brief Load the range in the prefetch thread. Pinned pages are not evicted for it
+    _INTERFACE_ void prefetch(vk::DeviceSize offset, vk::DeviceSize length) noexcept(false);
+    /// @param count number of pages to prefetch after sequential `acquire`. 0 disables it
+    _INTERFACE_ void set_prefetch_distance(uint32_t count) noexcept;
+
+  private:
+    void setup_sparse(vk::PhysicalDevice pdevice, uint32_t resident_pages, vk::BufferUsageFlags usage) noexcept(false);
+    void setup_software(vk::PhysicalDevice pdevice, uint32_t resident_pages,
+                        vk::BufferUsageFlags usage) noexcept(false);
+    void setup_upload(vk::PhysicalDevice pdevice, uint32_t queue_family, upload_context &context) noexcept(false);
+    void release_upload(upload_context &context) noexcept;
+    void release_resources() noexcept;
+
+    vk::DeviceSize get_bind_length(uint32_t vpage) const noexcept;
+    bool make_resident(uint32_t first, uint32_t count, bool pin, upload_context &context) noexcept(false);
+    void upload(std::unique_lock<std::mutex> &lck, upload_context &context, std::vector<page_upload> &batch,
+                bool pin) noexcept(false);
+    void bind(upload_context &context, std::span<const page_upload> batch) noexcept(false);
+    void transfer(upload_context &context, std::span<const page_upload> batch) noexcept(false);
+    void rollback(upload_context &context, std::vector<page_upload> &batch) noexcept;
+    void unbind(upload_context &context, std::span<const page_upload> batch) noexcept;
+    void schedule(uint32_t first, uint32_t count) noexcept(false);
+    void run_prefetch() noexcept;
+};
+
+} // namespace experiment
@@ -1,10 +1,20 @@
 // https://google.github.io/benchmark/user_guide.html
 #include <benchmark/benchmark.h>
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
 #include <thread>
+#include <vector>
 
 #include <experiment.hpp>
+#if defined(EXPERIMENT_VULKAN)
+#include <kernel_registry.hpp>
+#endif
 
 using namespace std::chrono_literals;
 
@@ -25,8 +35,272 @@ BENCHMARK_F(NoopFixture, Noop)(benchmark::State &state) {
     }
 }
 
+#if defined(EXPERIMENT_VULKAN)
+
+/// @brief Compare specialized transform kernels with the generic one on a CPU device(lavapipe)
+struct VulkanKernelFixture : public benchmark::Fixture {
+    static constexpr uint32_t count = 1 << 20;
+    static constexpr uint32_t input_a = 0x3FC00000; // 1.5f
+    static constexpr uint32_t input_b = 0x40000000; // 2.0f
+
+    std::unique_ptr<vk::DynamicLoader> loader = nullptr;
+    vk::DispatchLoaderDynamic dynamic{};
+    vk::Instance instance = nullptr;
+    vk::PhysicalDevice pdevice = nullptr;
+    vk::Device device = nullptr;
+    vk::Queue queue = nullptr;
+    std::array<vk::Buffer, 3> buffers{};
+    std::array<vk::DeviceMemory, 3> memories{};
+    vk::DescriptorPool descriptor_pool = nullptr;
+    vk::DescriptorSet set = nullptr;
+    vk::CommandPool command_pool = nullptr;
+    vk::CommandBuffer cmd = nullptr;
+    vk::Fence fence = nullptr;
+    std::unique_ptr<experiment::kernel_registry> registry = nullptr;
+
+    void SetUp(benchmark::State &state) {
+        try {
+            SetupDevice();
+            SetupResources();
+        } catch (const std::exception &ex) {
+            state.SkipWithError(ex.what());
+        }
+    }
+    void TearDown(benchmark::State &) {
+        if (device) {
+            device.waitIdle(dynamic);
+            registry = nullptr;
+            if (fence)
+                device.destroyFence(fence, nullptr, dynamic);
+            if (command_pool)
+                device.destroyCommandPool(command_pool, nullptr, dynamic);
+            if (descriptor_pool)
+                device.destroyDescriptorPool(descriptor_pool, nullptr, dynamic);
+            for (auto i = 0u; i < buffers.size(); ++i) {
+                if (buffers[i])
+                    device.destroyBuffer(buffers[i], nullptr, dynamic);
+                if (memories[i])
+                    device.freeMemory(memories[i], nullptr, dynamic);
+            }
+            device.destroy(nullptr, dynamic);
+        }
+        if (instance)
+            instance.destroy(nullptr, dynamic);
+        fence = nullptr;
+        cmd = nullptr;
+        command_pool = nullptr;
+        set = nullptr;
+        descriptor_pool = nullptr;
+        buffers = {};
+        memories = {};
+        queue = nullptr;
+        device = nullptr;
+        pdevice = nullptr;
+        instance = nullptr;
+        loader = nullptr;
+    }
+
+  private:
+    void SetupDevice() noexcept(false) {
+        // throws if the Vulkan library is not found
+        loader = std::make_unique<vk::DynamicLoader>();
+        dynamic.init(*loader);
+
+        std::vector<const char *> extension_names{};
+        vk::InstanceCreateInfo info{};
+        for (const vk::ExtensionProperties &ep : vk::enumerateInstanceExtensionProperties(nullptr, dynamic)) {
+            if (std::string_view{ep.extensionName.data()} != VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME)
+                continue;
+            extension_names.emplace_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
+            info.setFlags(vk::InstanceCreateFlagBits::eEnumeratePortabilityKHR);
+        }
+        vk::ApplicationInfo app{};
+        app.setApiVersion(VK_API_VERSION_1_3);
+        app.setApplicationVersion(VK_MAKE_VERSION(0, 1, 0));
+        info.setPApplicationInfo(&app);
+        info.setPEnabledExtensionNames(extension_names);
+        instance = vk::createInstance(info, nullptr, dynamic);
+        dynamic.init(instance);
+
+        for (vk::PhysicalDevice p : instance.enumeratePhysicalDevices(dynamic)) {
+            // lavapipe reports itself as a CPU device
+            if (p.getProperties(dynamic).deviceType != vk::PhysicalDeviceType::eCpu)
+                continue;
+            pdevice = p;
+            break;
+        }
+        if (pdevice == nullptr)
+            throw std::runtime_error{"CPU device(lavapipe) not found"};
+
+        uint32_t family = UINT32_MAX;
+        auto props = pdevice.getQueueFamilyProperties(dynamic);
+        for (uint32_t i = 0; i < props.size(); ++i) {
+            if (props[i].queueFlags & vk::QueueFlagBits::eCompute) {
+                family = i;
+                break;
+            }
+        }
+        if (family == UINT32_MAX)
+            throw std::runtime_error{"compute queue not found"};
+
+        float priority = 1.0f;
+        vk::DeviceQueueCreateInfo queue_info{{}, family, 1, &priority};
+        vk::DeviceCreateInfo device_info{};
+        device_info.setQueueCreateInfos(queue_info);
+        device = pdevice.createDevice(device_info, nullptr, dynamic);
+        dynamic.init(instance, device);
+        queue = device.getQueue(family, 0, dynamic);
+
+        vk::CommandPoolCreateInfo pool_info{vk::CommandPoolCreateFlagBits::eResetCommandBuffer, family};
+        command_pool = device.createCommandPool(pool_info, nullptr, dynamic);
+        vk::CommandBufferAllocateInfo cmd_info{command_pool, vk::CommandBufferLevel::ePrimary, 1};
+        cmd = device.allocateCommandBuffers(cmd_info, dynamic).front();
+        fence = device.createFence(vk::FenceCreateInfo{}, nullptr, dynamic);
+    }
+
+    uint32_t FindMemoryType(uint32_t requirement, vk::MemoryPropertyFlags flags) noexcept(false) {
+        vk::PhysicalDeviceMemoryProperties physical = pdevice.getMemoryProperties(dynamic);
+        for (uint32_t index = 0; index < physical.memoryTypeCount; ++index) {
+            if ((requirement & (1 << index)) == 0)
+                continue;
+            if ((physical.memoryTypes[index].propertyFlags & flags) == flags)
+                return index;
+        }
+        throw std::runtime_error{"device memory property not found"};
+    }
+
+    void SetupResources() noexcept(false) {
+        registry = std::make_unique<experiment::kernel_registry>(pdevice, device, dynamic);
+
+        const vk::DeviceSize size = sizeof(uint32_t) * count;
+        for (auto i = 0u; i < buffers.size(); ++i) {
+            vk::BufferCreateInfo info{{}, size, vk::BufferUsageFlagBits::eStorageBuffer, vk::SharingMode::eExclusive};
+            buffers[i] = device.createBuffer(info, nullptr, dynamic);
+            vk::MemoryRequirements reqs = device.getBufferMemoryRequirements(buffers[i], dynamic);
+            uint32_t index = FindMemoryType(reqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible |
+                                                                     vk::MemoryPropertyFlagBits::eHostCoherent);
+            memories[i] = device.allocateMemory(vk::MemoryAllocateInfo{reqs.size, index}, nullptr, dynamic);
+            device.bindBufferMemory(buffers[i], memories[i], 0, dynamic);
+
+            // 1.5f and 2.0f for the inputs, 0 for the output
+            const uint32_t values[3]{input_a, input_b, 0};
+            const uint32_t value = values[i];
+            auto ptr = static_cast<uint32_t *>(device.mapMemory(memories[i], 0, size, {}, dynamic));
+            std::fill_n(ptr, count, value);
+            device.unmapMemory(memories[i], dynamic);
+        }
+
+        vk::DescriptorPoolSize pool_size{vk::DescriptorType::eStorageBuffer, 3};
+        vk::DescriptorPoolCreateInfo pool_info{{}, 1, pool_size};
+        descriptor_pool = device.createDescriptorPool(pool_info, nullptr, dynamic);
+        vk::DescriptorSetLayout layout = registry->get_set_layout();
+        vk::DescriptorSetAllocateInfo set_info{descriptor_pool, layout};
+        set = device.allocateDescriptorSets(set_info, dynamic).front();
+
+        std::array<vk::DescriptorBufferInfo, 3> infos{};
+        std::array<vk::WriteDescriptorSet, 3> writes{};
+        for (auto i = 0u; i < buffers.size(); ++i) {
+            infos[i] = vk::DescriptorBufferInfo{buffers[i], 0, VK_WHOLE_SIZE};
+            writes[i].setDstSet(set);
+            writes[i].setDstBinding(i);
+            writes[i].setDescriptorType(vk::DescriptorType::eStorageBuffer);
+            writes[i].setBufferInfo(infos[i]);
+        }
+        device.updateDescriptorSets(writes, nullptr, dynamic);
+    }
+
+    template <typename Fn> void Submit(Fn &&fn) noexcept(false) {
+        cmd.reset({}, dynamic);
+        cmd.begin(vk::CommandBufferBeginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit}, dynamic);
+        fn(cmd);
+        // `Verify` reads the output on the host
+        vk::MemoryBarrier barrier{vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead};
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, {}, barrier,
+                            nullptr, nullptr, dynamic);
+        cmd.end(dynamic);
+        vk::SubmitInfo info{};
+        info.setCommandBuffers(cmd);
+        queue.submit(info, fence, dynamic);
+        if (device.waitForFences(fence, VK_TRUE, UINT64_MAX, dynamic) != vk::Result::eSuccess)
+            throw std::runtime_error{"vkWaitForFences"};
+        device.resetFences(fence, dynamic);
+    }
+
+    /// @see apply() in src/kernels/transform.comp. int32 and uint32 share the bits of wrapping arithmetic
+    static uint32_t Expect(const experiment::kernel_key &key) noexcept {
+        const bool add = key.op == experiment::kernel_op::add;
+        if (key.element_type == experiment::kernel_element<float>::id) {
+            const float x = std::bit_cast<float>(input_a);
+            const float y = std::bit_cast<float>(input_b);
+            return std::bit_cast<uint32_t>(add ? x + y : x * y);
+        }
+        return add ? input_a + input_b : input_a * input_b;
+    }
+
+    void Verify(benchmark::State &state, const experiment::kernel_key &key) noexcept(false) {
+        const uint32_t expected = Expect(key);
+        auto ptr = static_cast<const uint32_t *>(device.mapMemory(memories[2], 0, VK_WHOLE_SIZE, {}, dynamic));
+        const bool ok = std::all_of(ptr, ptr + count, [expected](uint32_t value) { return value == expected; });
+        device.unmapMemory(memories[2], dynamic);
+        if (ok == false)
+            state.SkipWithError("output mismatch");
+    }
+
+  protected:
+    template <typename Variant> void RunSpecialized(benchmark::State &state) noexcept(false) {
+        if (state.error_occurred())
+            return; // skipped in SetUp
+        // pipeline creation is not a part of the measurement
+        registry->get<Variant>();
+        for (auto _ : state)
+            Submit([this](vk::CommandBuffer command) { registry->record<Variant>(command, set, count); });
+        state.SetItemsProcessed(state.iterations() * count);
+        Verify(state, Variant::key);
+    }
+
+    void RunGeneric(benchmark::State &state, const experiment::kernel_key &key) noexcept(false) {
+        if (state.error_occurred())
+            return;
+        registry->get_generic();
+        for (auto _ : state)
+            Submit([this, &key](vk::CommandBuffer command) { registry->record_generic(command, set, key, count); });
+        state.SetItemsProcessed(state.iterations() * count);
+        Verify(state, key);
+    }
+};
+
+using experiment::kernel_op;
+using experiment::kernel_variant;
+
+BENCHMARK_F(VulkanKernelFixture, specialized_f32_w1_g64)(benchmark::State &state) {
+    RunSpecialized<kernel_variant<float, 1, 64>>(state);
+}
+BENCHMARK_F(VulkanKernelFixture, specialized_f32_w4_g64)(benchmark::State &state) {
+    RunSpecialized<kernel_variant<float, 4, 64>>(state);
+}
+BENCHMARK_F(VulkanKernelFixture, specialized_f32_w4_g256)(benchmark::State &state) {
+    RunSpecialized<kernel_variant<float, 4, 256>>(state);
+}
+BENCHMARK_F(VulkanKernelFixture, specialized_i32_w4_g64_mul)(benchmark::State &state) {
+    RunSpecialized<kernel_variant<int32_t, 4, 64, kernel_op::multiply>>(state);
+}
+
+BENCHMARK_F(VulkanKernelFixture, generic_f32_w1)(benchmark::State &state) {
+    RunGeneric(state, kernel_variant<float, 1, 64>::key);
+}
+BENCHMARK_F(VulkanKernelFixture, generic_f32_w4)(benchmark::State &state) {
+    RunGeneric(state, kernel_variant<float, 4, 64>::key);
+}
+BENCHMARK_F(VulkanKernelFixture, generic_i32_w4_mul)(benchmark::State &state) {
+    RunGeneric(state, kernel_variant<int32_t, 4, 64, kernel_op::multiply>::key);
+}
+
+#endif
+
 int main(int argc, char *argv[]) {
+#if defined(_WIN32)
     winrt::init_apartment(winrt::apartment_type::multi_threaded);
+#endif
     benchmark::Initialize(&argc, argv);
     if (benchmark::ReportUnrecognizedArguments(argc, argv))
         return EXIT_FAILURE;
@@ -0,0 +1,928 @@
+/**
+ * @brief Tests of the compute helpers with any Vulkan runtime. e.g. lavapipe on Linux, MoltenVK on macOS
+ * @see https://registry.khronos.org/vulkan/specs/1.3-extensions/html/
+ * @see https://docs.mesa3d.org/drivers/llvmpipe.html
+ */
+#include <gtest/gtest.h>
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <span>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include <descriptor_heap.hpp>
+#include <kernel_registry.hpp>
+#include <streaming_buffer.hpp>
+
+#include "heap_read.spv.h" // test/kernels/heap_read.comp
+
+static bool has_extension(const std::vector<vk::ExtensionProperties> &properties, std::string_view name) noexcept {
+    for (const vk::ExtensionProperties &ep : properties)
+        if (name == ep.extensionName.data())
+            return true;
+    return false;
+}
+
+/// @brief Instance and a device with one compute queue. Skipped when there is no Vulkan runtime
+/// @note  The first physical device with a compute queue is used.
+///        Use `VK_DRIVER_FILES`(or `VK_ICD_FILENAMES`) to select the driver. e.g. lvp_icd.x86_64.json
+struct ComputeTest : public testing::Test {
+    std::unique_ptr<vk::DynamicLoader> loader = nullptr;
+    vk::DispatchLoaderDynamic dynamic{};
+    vk::Instance instance = nullptr;
+    vk::PhysicalDevice pdevice = nullptr;
+    uint32_t queue_family = UINT32_MAX;
+    vk::Device device = nullptr;
+    vk::Queue queue = nullptr;
+    vk::CommandPool command_pool = nullptr;
+    vk::CommandBuffer cmd = nullptr;
+    vk::Fence fence = nullptr;
+    std::vector<vk::Buffer> buffers{};
+    std::vector<vk::DeviceMemory> memories{};
+
+    void SetUp() {
+        try {
+            loader = std::make_unique<vk::DynamicLoader>();
+            dynamic.init(*loader);
+            SetupInstance();
+            dynamic.init(instance);
+        } catch (const std::runtime_error &ex) {
+            // case: no Vulkan library, Incompatible Vulkan Driver
+            GTEST_SKIP() << ex.what();
+        }
+        for (vk::PhysicalDevice p : instance.enumeratePhysicalDevices(dynamic)) {
+            auto props = p.getQueueFamilyProperties(dynamic);
+            for (uint32_t i = 0; i < props.size(); ++i) {
+                if ((props[i].queueFlags & vk::QueueFlagBits::eCompute) == vk::QueueFlags{})
+                    continue;
+                pdevice = p;
+                queue_family = i;
+                break;
+            }
+            if (pdevice)
+                break;
+        }
+        if (pdevice == nullptr)
+            GTEST_SKIP() << "compute queue not found";
+        spdlog::debug("physical device: {}", pdevice.getProperties(dynamic).deviceName.data());
+    }
+    void TearDown() {
+        if (device) {
+            device.waitIdle(dynamic);
+            for (vk::Buffer buffer : buffers)
+                device.destroyBuffer(buffer, nullptr, dynamic);
+            for (vk::DeviceMemory memory : memories)
+                device.freeMemory(memory, nullptr, dynamic);
+            if (fence)
+                device.destroyFence(fence, nullptr, dynamic);
+            if (command_pool)
+                device.destroyCommandPool(command_pool, nullptr, dynamic);
+            device.destroy(nullptr, dynamic);
+        }
+        if (instance)
+            instance.destroy(nullptr, dynamic);
+    }
+
+  private:
+    void SetupInstance() noexcept(false) {
+        std::vector<const char *> extension_names{};
+        vk::InstanceCreateInfo info{};
+        // MoltenVK is listed only with the portability enumeration
+        if (has_extension(vk::enumerateInstanceExtensionProperties(nullptr, dynamic),
+                          VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME)) {
+            extension_names.emplace_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
+            info.setFlags(vk::InstanceCreateFlagBits::eEnumeratePortabilityKHR);
+        }
+        vk::ApplicationInfo app{};
+        app.setApiVersion(VK_API_VERSION_1_3);
+        app.setApplicationVersion(VK_MAKE_VERSION(0, 1, 0));
+        info.setPApplicationInfo(&app);
+        info.setPEnabledExtensionNames(extension_names);
+        instance = vk::createInstance(info, nullptr, dynamic);
+    }
+
+  protected:
+    /// @param next features to enable, chained to `vk::DeviceCreateInfo`
+    void MakeComputeDevice(const void *next, std::vector<const char *> extension_names) noexcept(false) {
+        // required if the device has it
+        if (has_extension(pdevice.enumerateDeviceExtensionProperties(nullptr, dynamic), "VK_KHR_portability_subset"))
+            extension_names.emplace_back("VK_KHR_portability_subset");
+        float priority = 1.0f;
+        vk::DeviceQueueCreateInfo queue_info{{}, queue_family, 1, &priority};
+        vk::DeviceCreateInfo info{};
+        info.setPNext(next);
+        info.setQueueCreateInfos(queue_info);
+        info.setPEnabledExtensionNames(extension_names);
+        device = pdevice.createDevice(info, nullptr, dynamic);
+        dynamic.init(instance, device);
+        queue = device.getQueue(queue_family, 0, dynamic);
+
+        vk::CommandPoolCreateInfo pool_info{vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queue_family};
+        command_pool = device.createCommandPool(pool_info, nullptr, dynamic);
+        vk::CommandBufferAllocateInfo cmd_info{command_pool, vk::CommandBufferLevel::ePrimary, 1};
+        cmd = device.allocateCommandBuffers(cmd_info, dynamic).front();
+        fence = device.createFence(vk::FenceCreateInfo{}, nullptr, dynamic);
+    }
+
+    /// @note host-visible, host-coherent. released in `TearDown`
+    vk::Buffer MakeHostBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::DeviceMemory &memory,
+                              const void *allocate_next = nullptr) noexcept(false) {
+        vk::BufferCreateInfo info{{}, size, usage, vk::SharingMode::eExclusive};
+        vk::Buffer buffer = buffers.emplace_back(device.createBuffer(info, nullptr, dynamic));
+        vk::MemoryRequirements reqs = device.getBufferMemoryRequirements(buffer, dynamic);
+        const vk::MemoryPropertyFlags flags =
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+        vk::PhysicalDeviceMemoryProperties physical = pdevice.getMemoryProperties(dynamic);
+        uint32_t index = UINT32_MAX;
+        for (uint32_t i = 0; i < physical.memoryTypeCount && index == UINT32_MAX; ++i)
+            if ((reqs.memoryTypeBits & (1 << i)) && (physical.memoryTypes[i].propertyFlags & flags) == flags)
+                index = i;
+        if (index == UINT32_MAX)
+            throw std::runtime_error{"device memory property not found"};
+        vk::MemoryAllocateInfo allocate{reqs.size, index, allocate_next};
+        memory = memories.emplace_back(device.allocateMemory(allocate, nullptr, dynamic));
+        device.bindBufferMemory(buffer, memory, 0, dynamic);
+        return buffer;
+    }
+
+    /// @brief Record with `fn` and wait for the submission.
+    ///        Writes of compute shaders and transfers are visible to the host after this
+    template <typename Fn> void Submit(Fn &&fn) noexcept(false) {
+        cmd.reset({}, dynamic);
+        cmd.begin(vk::CommandBufferBeginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit}, dynamic);
+        fn(cmd);
+        vk::MemoryBarrier barrier{vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite,
+                                  vk::AccessFlagBits::eHostRead};
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer,
+                            vk::PipelineStageFlagBits::eHost, {}, barrier, nullptr, nullptr, dynamic);
+        cmd.end(dynamic);
+        vk::SubmitInfo info{};
+        info.setCommandBuffers(cmd);
+        queue.submit(info, fence, dynamic);
+        if (device.waitForFences(fence, VK_TRUE, UINT64_MAX, dynamic) != vk::Result::eSuccess)
+            throw std::runtime_error{"vkWaitForFences"};
+        device.resetFences(fence, dynamic);
+    }
+};
+
+struct VulkanKernelTest : public ComputeTest {
+    static constexpr uint32_t count = 1001; // not a multiple of the workgroup sizes and vector widths
+
+    std::unique_ptr<experiment::kernel_registry> registry = nullptr;
+    std::array<vk::DeviceMemory, 3> abc{};
+    vk::DescriptorPool descriptor_pool = nullptr;
+    vk::DescriptorSet set = nullptr;
+
+    void SetUp() {
+        ComputeTest::SetUp();
+        if (IsSkipped())
+            return;
+        try {
+            MakeComputeDevice(nullptr, {});
+            registry = std::make_unique<experiment::kernel_registry>(pdevice, device, dynamic);
+
+            std::array<vk::DescriptorBufferInfo, 3> infos{};
+            for (auto i = 0u; i < abc.size(); ++i)
+                infos[i] = vk::DescriptorBufferInfo{
+                    MakeHostBuffer(sizeof(uint32_t) * count, vk::BufferUsageFlagBits::eStorageBuffer, abc[i]), 0,
+                    VK_WHOLE_SIZE};
+
+            vk::DescriptorPoolSize pool_size{vk::DescriptorType::eStorageBuffer, 3};
+            descriptor_pool = device.createDescriptorPool(vk::DescriptorPoolCreateInfo{{}, 1, pool_size}, nullptr,
+                                                          dynamic);
+            vk::DescriptorSetLayout layout = registry->get_set_layout();
+            set = device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{descriptor_pool, layout}, dynamic)
+                      .front();
+            std::array<vk::WriteDescriptorSet, 3> writes{};
+            for (auto i = 0u; i < writes.size(); ++i) {
+                writes[i].setDstSet(set);
+                writes[i].setDstBinding(i);
+                writes[i].setDescriptorType(vk::DescriptorType::eStorageBuffer);
+                writes[i].setBufferInfo(infos[i]);
+            }
+            device.updateDescriptorSets(writes, nullptr, dynamic);
+        } catch (const vk::SystemError &ex) {
+            GTEST_FAIL() << ex.what();
+        }
+    }
+    void TearDown() {
+        registry = nullptr;
+        if (descriptor_pool)
+            device.destroyDescriptorPool(descriptor_pool, nullptr, dynamic);
+        ComputeTest::TearDown();
+    }
+
+    static uint32_t InputA(const experiment::kernel_key &key, uint32_t i) noexcept {
+        if (key.element_type == experiment::kernel_element<float>::id)
+            return std::bit_cast<uint32_t>(static_cast<float>(i) * 0.5f);
+        return i - 500; // negative values for int32
+    }
+    static uint32_t InputB(const experiment::kernel_key &key, uint32_t i) noexcept {
+        if (key.element_type == experiment::kernel_element<float>::id)
+            return std::bit_cast<uint32_t>(3.0f);
+        return 7 + (i % 3);
+    }
+    /// @see apply() in src/kernels/transform.comp. int32 and uint32 share the bits of wrapping arithmetic
+    static uint32_t Expect(const experiment::kernel_key &key, uint32_t lhs, uint32_t rhs) noexcept {
+        const bool add = key.op == experiment::kernel_op::add;
+        if (key.element_type == experiment::kernel_element<float>::id) {
+            const float x = std::bit_cast<float>(lhs);
+            const float y = std::bit_cast<float>(rhs);
+            return std::bit_cast<uint32_t>(add ? x + y : x * y);
+        }
+        return add ? lhs + rhs : lhs * rhs;
+    }
+
+    template <typename Fn> void Run(const experiment::kernel_key &key, Fn &&record) {
+        std::array<uint32_t *, 3> ptrs{};
+        for (auto i = 0u; i < abc.size(); ++i)
+            ptrs[i] = static_cast<uint32_t *>(device.mapMemory(abc[i], 0, VK_WHOLE_SIZE, {}, dynamic));
+        for (uint32_t i = 0; i < count; ++i) {
+            ptrs[0][i] = InputA(key, i);
+            ptrs[1][i] = InputB(key, i);
+            ptrs[2][i] = 0xDEADBEEF;
+        }
+        Submit(record);
+        for (uint32_t i = 0; i < count; ++i)
+            ASSERT_EQ(ptrs[2][i], Expect(key, ptrs[0][i], ptrs[1][i])) << "index " << i;
+        for (auto i = 0u; i < abc.size(); ++i)
+            device.unmapMemory(abc[i], dynamic);
+    }
+
+    template <typename Variant> void RunSpecialized() {
+        Run(Variant::key, [this](vk::CommandBuffer command) { registry->record<Variant>(command, set, count); });
+    }
+    void RunGeneric(const experiment::kernel_key &key) {
+        Run(key, [this, &key](vk::CommandBuffer command) { registry->record_generic(command, set, key, count); });
+    }
+};
+
+using experiment::kernel_op;
+using variant0_t = experiment::kernel_variant<float, 4, 64>;
+using variant1_t = experiment::kernel_variant<uint32_t, 1, 128, kernel_op::multiply>;
+using variant2_t = experiment::kernel_variant<int32_t, 2, 32, kernel_op::add>;
+using variant3_t = experiment::kernel_variant<float, 1, 256, kernel_op::multiply>;
+
+TEST_F(VulkanKernelTest, registry_lazy_cache) {
+    static_assert(variant0_t::elements_per_group == 256);
+    static_assert(variant0_t::key != variant1_t::key);
+
+    try {
+        ASSERT_TRUE(registry->get_set_layout());
+        ASSERT_TRUE(registry->get_pipeline_layout());
+        ASSERT_EQ(registry->size(), 0);
+
+        vk::Pipeline pipeline0 = registry->get<variant0_t>();
+        ASSERT_TRUE(pipeline0);
+        ASSERT_EQ(registry->get<variant0_t>(), pipeline0);
+        ASSERT_EQ(registry->size(), 1);
+
+        vk::Pipeline pipeline1 = registry->get<variant1_t>();
+        ASSERT_TRUE(pipeline1);
+        ASSERT_NE(pipeline0, pipeline1);
+        ASSERT_EQ(registry->get(variant1_t::key), pipeline1);
+        ASSERT_EQ(registry->size(), 2);
+
+        // the generic pipeline is not a part of the specialized cache
+        vk::Pipeline generic = registry->get_generic();
+        ASSERT_TRUE(generic);
+        ASSERT_EQ(registry->get_generic(), generic);
+        ASSERT_EQ(registry->size(), 2);
+    } catch (const vk::SystemError &e) {
+        GTEST_FAIL() << e.what();
+    }
+}
+
+TEST_F(VulkanKernelTest, dispatch_specialized) {
+    try {
+        RunSpecialized<variant0_t>();
+        RunSpecialized<variant1_t>();
+        RunSpecialized<variant2_t>();
+        RunSpecialized<variant3_t>();
+    } catch (const vk::SystemError &e) {
+        GTEST_FAIL() << e.what();
+    }
+}
+
+TEST_F(VulkanKernelTest, dispatch_generic) {
+    try {
+        RunGeneric(variant0_t::key);
+        RunGeneric(variant1_t::key);
+        RunGeneric(variant2_t::key);
+        RunGeneric(variant3_t::key);
+    } catch (const vk::SystemError &e) {
+        GTEST_FAIL() << e.what();
+    }
+}
+
+TEST_F(VulkanKernelTest, invalid_key) {
+    using experiment::kernel_key;
+    EXPECT_THROW(registry->get(kernel_key{0, 0, 64, kernel_op::add}), std::invalid_argument);
+    EXPECT_THROW(registry->get(kernel_key{0, 3, 64, kernel_op::add}), std::invalid_argument);
+    EXPECT_THROW(registry->get(kernel_key{3, 1, 64, kernel_op::add}), std::invalid_argument);
+    EXPECT_THROW(registry->get(kernel_key{0, 1, 0, kernel_op::add}), std::invalid_argument);
+    EXPECT_THROW(registry->get(kernel_key{0, 1, 2048, kernel_op::add}), std::invalid_argument);
+    EXPECT_THROW(registry->get(kernel_key{0, 1, 64, static_cast<kernel_op>(2)}), std::invalid_argument);
+    EXPECT_EQ(registry->size(), 0);
+
+    // too many groups for the device
+    const uint32_t max_group_count = pdevice.getProperties(dynamic).limits.maxComputeWorkGroupCount[0];
+    if (uint64_t{max_group_count} * experiment::kernel_registry::generic_workgroup_size < UINT32_MAX) {
+        Submit([this](vk::CommandBuffer command) {
+            EXPECT_THROW(registry->record_generic(command, set, variant0_t::key, UINT32_MAX), std::invalid_argument);
+        });
+    }
+}
+
+TEST(DescriptorSlotAllocatorTest, allocate_until_exhausted) {
+    experiment::descriptor_slot_allocator slots{4};
+    std::set<uint32_t> allocated{};
+    for (auto i = 0u; i < slots.get_capacity(); ++i) {
+        uint32_t slot = slots.allocate();
+        ASSERT_LT(slot, slots.get_capacity());
+        ASSERT_FALSE(allocated.contains(slot));
+        allocated.insert(slot);
+    }
+    ASSERT_EQ(slots.allocate(), experiment::descriptor_slot_allocator::invalid);
+}
+
+TEST(DescriptorSlotAllocatorTest, fence_gated_reuse) {
+    experiment::descriptor_slot_allocator slots{1};
+    uint32_t slot = slots.allocate();
+    ASSERT_EQ(slot, 0);
+    slots.release(slot, 5);
+    // the GPU may still read the slot
+    ASSERT_EQ(slots.collect(4), 0);
+    ASSERT_EQ(slots.allocate(), experiment::descriptor_slot_allocator::invalid);
+    ASSERT_EQ(slots.collect(5), 1);
+    ASSERT_EQ(slots.allocate(), slot);
+}
+
+TEST(DescriptorSlotAllocatorTest, double_release) {
+    experiment::descriptor_slot_allocator slots{2};
+    ASSERT_FALSE(slots.release(1, 0)); // not allocated yet
+    uint32_t slot = slots.allocate();
+    ASSERT_TRUE(slots.release(slot, 1));
+    ASSERT_FALSE(slots.release(slot, 1));
+    // the retired list has no cycle
+    ASSERT_EQ(slots.collect(1), 1);
+    ASSERT_FALSE(slots.release(slot, 2));
+    ASSERT_EQ(slots.collect(2), 0);
+}
+
+TEST(DescriptorSlotAllocatorTest, concurrent_allocate_release) {
+    constexpr uint32_t capacity = 64;
+    experiment::descriptor_slot_allocator slots{capacity};
+    std::array<std::atomic_flag, capacity> owned{};
+    std::atomic_uint32_t duplicates{0};
+    std::atomic_uint32_t rejected{0};
+
+    auto work = [&slots, &owned, &duplicates, &rejected](uint64_t fence_value) {
+        for (auto i = 0; i < 10'000; ++i) {
+            uint32_t slot = slots.allocate();
+            if (slot == experiment::descriptor_slot_allocator::invalid) {
+                slots.collect(UINT64_MAX);
+                continue;
+            }
+            if (owned[slot].test_and_set())
+                duplicates.fetch_add(1);
+            // hold the slot while the other threads allocate
+            std::this_thread::yield();
+            owned[slot].clear();
+            if (slots.release(slot, fence_value) == false)
+                rejected.fetch_add(1);
+        }
+    };
+    std::vector<std::thread> threads{};
+    for (auto t = 0u; t < 4; ++t)
+        threads.emplace_back(work, t);
+    for (auto &thread : threads)
+        thread.join();
+    ASSERT_EQ(duplicates.load(), 0);
+    ASSERT_EQ(rejected.load(), 0);
+
+    // every slot must come back after the last fence
+    slots.collect(UINT64_MAX);
+    std::set<uint32_t> allocated{};
+    for (auto i = 0u; i < capacity; ++i)
+        allocated.insert(slots.allocate());
+    ASSERT_EQ(allocated.size(), capacity);
+    ASSERT_FALSE(allocated.contains(experiment::descriptor_slot_allocator::invalid));
+}
+
+TEST_F(ComputeTest, query_descriptor_heap_mode) {
+    for (vk::PhysicalDevice p : instance.enumeratePhysicalDevices(dynamic)) {
+        auto mode = experiment::query_descriptor_heap_mode(p, dynamic, vk::DescriptorType::eStorageBuffer);
+        auto name = p.getProperties(dynamic).deviceName;
+        spdlog::info("{}: descriptor_heap_mode {}", name.data(), static_cast<uint32_t>(mode));
+        ASSERT_EQ(experiment::query_descriptor_heap_mode(p, dynamic, vk::DescriptorType::eSampler),
+                  experiment::descriptor_heap_mode::none);
+    }
+}
+
+struct DescriptorHeapTest : public ComputeTest {
+    static constexpr vk::DescriptorType type = vk::DescriptorType::eStorageBuffer;
+    static constexpr uint32_t capacity = 64; // HEAP_CAPACITY of test/kernels/heap_read.comp
+    experiment::descriptor_heap_mode mode = experiment::descriptor_heap_mode::none;
+    vk::PipelineLayout pipeline_layout = nullptr;
+    vk::ShaderModule module = nullptr;
+    vk::Pipeline pipeline = nullptr;
+
+    void SetUp() {
+        ComputeTest::SetUp();
+        if (IsSkipped())
+            return;
+        mode = experiment::query_descriptor_heap_mode(pdevice, dynamic, type);
+        if (mode == experiment::descriptor_heap_mode::none)
+            GTEST_SKIP() << "descriptor heap is not supported";
+        // the shader indexes the heap with a value from the memory
+        if (pdevice.getFeatures(dynamic).shaderStorageBufferArrayDynamicIndexing == false)
+            GTEST_SKIP() << "shaderStorageBufferArrayDynamicIndexing is not supported";
+
+        // enable the features of the mode. see query_descriptor_heap_mode
+        vk::PhysicalDeviceFeatures2 features{};
+        features.features.setShaderStorageBufferArrayDynamicIndexing(true);
+        vk::PhysicalDeviceDescriptorIndexingFeatures indexing{};
+        vk::PhysicalDeviceBufferDeviceAddressFeatures address{};
+        vk::PhysicalDeviceDescriptorBufferFeaturesEXT descriptor_buffer{};
+        if (mode == experiment::descriptor_heap_mode::descriptor_indexing) {
+            indexing.setRuntimeDescriptorArray(true);
+            indexing.setDescriptorBindingPartiallyBound(true);
+            indexing.setDescriptorBindingStorageBufferUpdateAfterBind(true);
+            features.setPNext(&indexing);
+            // core in Vulkan 1.2
+            std::vector<const char *> extension_names{};
+            if (pdevice.getProperties(dynamic).apiVersion < VK_API_VERSION_1_2)
+                extension_names.emplace_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+            MakeComputeDevice(&features, extension_names);
+        } else {
+            descriptor_buffer.setDescriptorBuffer(true);
+            address.setBufferDeviceAddress(true);
+            address.setPNext(&descriptor_buffer);
+            features.setPNext(&address);
+            MakeComputeDevice(&features, {VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME});
+        }
+    }
+    void TearDown() {
+        if (pipeline)
+            device.destroyPipeline(pipeline, nullptr, dynamic);
+        if (module)
+            device.destroyShaderModule(module, nullptr, dynamic);
+        if (pipeline_layout)
+            device.destroyPipelineLayout(pipeline_layout, nullptr, dynamic);
+        ComputeTest::TearDown();
+    }
+
+  protected:
+    /// @brief pipeline of test/kernels/heap_read.comp with the set layout of the heap
+    void MakePipeline(vk::DescriptorSetLayout set_layout) noexcept(false) {
+        vk::PushConstantRange range{vk::ShaderStageFlagBits::eCompute, 0, sizeof(uint32_t) * 2};
+        vk::PipelineLayoutCreateInfo layout_info{};
+        layout_info.setSetLayouts(set_layout);
+        layout_info.setPushConstantRanges(range);
+        pipeline_layout = device.createPipelineLayout(layout_info, nullptr, dynamic);
+
+        vk::ShaderModuleCreateInfo module_info{};
+        module_info.setCode(std::span<const uint32_t>{heap_read_spv});
+        module = device.createShaderModule(module_info, nullptr, dynamic);
+
+        vk::ComputePipelineCreateInfo info{};
+        // descriptor buffers can't be bound to the other pipelines
+        if (mode == experiment::descriptor_heap_mode::descriptor_buffer)
+            info.setFlags(vk::PipelineCreateFlagBits::eDescriptorBufferEXT);
+        info.setStage(vk::PipelineShaderStageCreateInfo{{}, vk::ShaderStageFlagBits::eCompute, module, "main"});
+        info.setLayout(pipeline_layout);
+        auto [result, p] = device.createComputePipeline(nullptr, info, nullptr, dynamic);
+        if (result != vk::Result::eSuccess)
+            throw std::runtime_error{"vkCreateComputePipelines"};
+        pipeline = p;
+    }
+};
+
+static uint32_t Marker(uint32_t region) noexcept {
+    return 0xC0DE0000 | region;
+}
+
+TEST_F(DescriptorHeapTest, concurrent_write_and_bind) {
+    constexpr uint32_t thread_count = 4;
+    constexpr uint32_t slot_count = 8; // per thread
+    constexpr uint32_t count = thread_count * slot_count;
+    std::unique_ptr<experiment::descriptor_heap> heap{};
+    try {
+        heap = std::make_unique<experiment::descriptor_heap>(pdevice, device, dynamic, mode, type, capacity);
+    } catch (const std::invalid_argument &ex) {
+        // case: the device limits
+        GTEST_SKIP() << ex.what();
+    }
+    ASSERT_EQ(heap->get_capacity(), capacity);
+
+    vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer;
+    vk::MemoryAllocateFlagsInfo allocate_flags{};
+    const void *allocate_next = nullptr;
+    if (mode == experiment::descriptor_heap_mode::descriptor_buffer) {
+        usage |= vk::BufferUsageFlagBits::eShaderDeviceAddress;
+        allocate_flags.setFlags(vk::MemoryAllocateFlagBits::eDeviceAddress);
+        allocate_next = &allocate_flags;
+    }
+    // each slot has its own region. the first value of the region is its marker
+    constexpr vk::DeviceSize range = 256;
+    vk::DeviceMemory memory{};
+    vk::Buffer buffer = MakeHostBuffer(range * count, usage, memory, allocate_next);
+    auto values = static_cast<uint32_t *>(device.mapMemory(memory, 0, VK_WHOLE_SIZE, {}, dynamic));
+    for (uint32_t region = 0; region < count; ++region)
+        values[region * range / sizeof(uint32_t)] = Marker(region);
+
+    // regions[t][i] is written to allocated[t][i]
+    std::vector<std::vector<uint32_t>> allocated(thread_count);
+    auto work = [&](uint32_t t) {
+        for (auto i = 0u; i < slot_count; ++i) {
+            uint32_t slot = heap->allocate();
+            if (slot == experiment::descriptor_slot_allocator::invalid)
+                return;
+            heap->write(slot, vk::DescriptorBufferInfo{buffer, range * (t * slot_count + i), range});
+            allocated[t].emplace_back(slot);
+        }
+    };
+    std::vector<std::thread> threads{};
+    for (auto t = 0u; t < thread_count; ++t)
+        threads.emplace_back(work, t);
+    for (auto &thread : threads)
+        thread.join();
+    for (const auto &slots : allocated)
+        ASSERT_EQ(slots.size(), slot_count);
+
+    // the table lists the slots. the shader replaces them with the markers
+    vk::DeviceMemory table_memory{};
+    vk::Buffer table = MakeHostBuffer(sizeof(uint32_t) * count, usage, table_memory, allocate_next);
+    auto entries = static_cast<uint32_t *>(device.mapMemory(table_memory, 0, VK_WHOLE_SIZE, {}, dynamic));
+    for (uint32_t t = 0; t < thread_count; ++t)
+        for (uint32_t i = 0; i < slot_count; ++i)
+            entries[t * slot_count + i] = allocated[t][i];
+    const uint32_t table_slot = heap->allocate();
+    ASSERT_NE(table_slot, experiment::descriptor_slot_allocator::invalid);
+    heap->write(table_slot, vk::DescriptorBufferInfo{table, 0, sizeof(uint32_t) * count});
+
+    MakePipeline(heap->get_set_layout());
+    Submit([this, &heap, table_slot](vk::CommandBuffer command) {
+        command.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline, dynamic);
+        heap->record_bind(command, vk::PipelineBindPoint::eCompute, pipeline_layout, 0);
+        const std::array<uint32_t, 2> constants{table_slot, count};
+        command.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants),
+                              constants.data(), dynamic);
+        command.dispatch(count, 1, 1, dynamic);
+    });
+    for (uint32_t region = 0; region < count; ++region)
+        EXPECT_EQ(entries[region], Marker(region)) << "slot " << allocated[region / slot_count][region % slot_count];
+
+    for (const auto &slots : allocated)
+        for (uint32_t slot : slots)
+            ASSERT_TRUE(heap->release(slot, 1));
+    ASSERT_TRUE(heap->release(table_slot, 1));
+    ASSERT_EQ(heap->collect(0), 0);
+    ASSERT_EQ(heap->collect(1), count + 1);
+}
+
+TEST(PageTableTest, clock_eviction) {
+    experiment::page_table pages{8, 2};
+    uint32_t evicted = 0;
+    ASSERT_EQ(pages.map(0, evicted), 0);
+    ASSERT_EQ(evicted, experiment::page_table::invalid);
+    ASSERT_EQ(pages.map(1, evicted), 1);
+    ASSERT_EQ(evicted, experiment::page_table::invalid);
+    pages.finish(0);
+    pages.finish(1);
+
+    // both are referenced. the first round gives them a second chance
+    ASSERT_EQ(pages.map(2, evicted), 0);
+    ASSERT_EQ(evicted, 0);
+    ASSERT_EQ(pages.find(0), experiment::page_table::invalid);
+    ASSERT_EQ(pages.find(2), 0);
+    pages.finish(2);
+
+    // page 2 is used again, so page 1 is the victim
+    pages.pin(2);
+    pages.unpin(2);
+    ASSERT_EQ(pages.map(3, evicted), 1);
+    ASSERT_EQ(evicted, 1);
+}
+
+TEST(PageTableTest, pinned_pages_are_not_evicted) {
+    experiment::page_table pages{8, 2};
+    uint32_t evicted = 0;
+    ASSERT_EQ(pages.map(0, evicted), 0);
+    ASSERT_EQ(pages.map(1, evicted), 1);
+    pages.finish(0);
+    pages.finish(1);
+    pages.pin(0);
+    pages.pin(1);
+    ASSERT_EQ(pages.map(2, evicted), experiment::page_table::invalid);
+    ASSERT_EQ(pages.find(2), experiment::page_table::invalid);
+
+    pages.unpin(1);
+    ASSERT_EQ(pages.map(2, evicted), 1);
+    ASSERT_EQ(evicted, 1);
+    ASSERT_EQ(pages.find(0), 0);
+}
+
+TEST(PageTableTest, loading_pages_are_not_evicted) {
+    experiment::page_table pages{8, 2};
+    uint32_t evicted = 0;
+    ASSERT_EQ(pages.map(0, evicted), 0);
+    ASSERT_EQ(pages.map(1, evicted), 1);
+    ASSERT_EQ(pages.get_loading_count(), 2);
+    ASSERT_TRUE(pages.is_loading(0));
+    ASSERT_EQ(pages.map(2, evicted), experiment::page_table::invalid);
+
+    pages.finish(1);
+    ASSERT_FALSE(pages.is_loading(1));
+    ASSERT_EQ(pages.get_loading_count(), 1);
+    ASSERT_EQ(pages.map(2, evicted), 1);
+    ASSERT_EQ(evicted, 1);
+    ASSERT_TRUE(pages.is_loading(2));
+    ASSERT_FALSE(pages.is_loading(1));
+}
+
+TEST(PageTableTest, free_page_before_eviction) {
+    experiment::page_table pages{8, 2};
+    uint32_t evicted = 0;
+    ASSERT_EQ(pages.map(0, evicted), 0);
+    ASSERT_EQ(pages.map(1, evicted), 1);
+    pages.finish(0);
+    pages.finish(1);
+    ASSERT_EQ(pages.map(2, evicted), 0);
+    ASSERT_EQ(evicted, 0);
+    pages.unmap(2);
+    // physical page 0 is free. page 1 must stay
+    ASSERT_EQ(pages.map(3, evicted), 0);
+    ASSERT_EQ(evicted, experiment::page_table::invalid);
+    ASSERT_EQ(pages.find(1), 1);
+}
+
+TEST(PageTableTest, unmap) {
+    experiment::page_table pages{4, 1};
+    uint32_t evicted = 0;
+    ASSERT_EQ(pages.map(3, evicted), 0);
+    pages.pin(3);
+    pages.unmap(3);
+    ASSERT_EQ(pages.find(3), experiment::page_table::invalid);
+    ASSERT_EQ(pages.get_loading_count(), 0);
+    ASSERT_EQ(pages.map(1, evicted), 0);
+    ASSERT_EQ(evicted, experiment::page_table::invalid);
+}
+
+struct StreamingBufferTest : public ComputeTest {
+    static constexpr uint32_t virtual_count = 8;
+    static constexpr uint32_t resident_count = 3;
+    vk::DeviceSize page_size = 256;
+    std::mutex queue_mtx{};
+    std::unique_ptr<experiment::streaming_buffer> stream{};
+    vk::Buffer pool_readback = nullptr;    // software
+    vk::Buffer table_readback = nullptr;   // software
+    vk::Buffer virtual_readback = nullptr; // sparse
+    uint32_t *pool_mapping = nullptr;
+    uint32_t *table_mapping = nullptr;
+    uint32_t *virtual_mapping = nullptr;
+
+    static uint32_t Pattern(uint32_t vpage, uint32_t index) noexcept {
+        return (vpage << 16) | index;
+    }
+
+    void SetUp() {
+        ComputeTest::SetUp();
+        if (IsSkipped())
+            return;
+        MakeComputeDevice(nullptr, {});
+        MakeStream(experiment::streaming_buffer_mode::software);
+    }
+    void TearDown() {
+        // the prefetch thread must stop before the device
+        stream = nullptr;
+        ComputeTest::TearDown();
+    }
+
+  protected:
+    void MakeStream(experiment::streaming_buffer_mode mode) noexcept(false) {
+        stream = std::make_unique<experiment::streaming_buffer>(
+            pdevice, device, dynamic, mode, queue, queue_mtx, queue_family, page_size * virtual_count, page_size,
+            resident_count, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc,
+            [](uint32_t vpage, std::span<std::byte> dst) {
+                auto values = reinterpret_cast<uint32_t *>(dst.data());
+                for (uint32_t i = 0; i < dst.size() / sizeof(uint32_t); ++i)
+                    values[i] = Pattern(vpage, i);
+            });
+        stream->set_prefetch_distance(0);
+
+        if (mode == experiment::streaming_buffer_mode::sparse) {
+            vk::DeviceMemory memory{};
+            virtual_readback = MakeHostBuffer(page_size * virtual_count, vk::BufferUsageFlagBits::eTransferDst, memory);
+            virtual_mapping = static_cast<uint32_t *>(device.mapMemory(memory, 0, VK_WHOLE_SIZE, {}, dynamic));
+            return;
+        }
+        vk::DeviceMemory memory0{}, memory1{};
+        pool_readback = MakeHostBuffer(page_size * resident_count, vk::BufferUsageFlagBits::eTransferDst, memory0);
+        table_readback = MakeHostBuffer(sizeof(uint32_t) * virtual_count, vk::BufferUsageFlagBits::eTransferDst, memory1);
+        pool_mapping = static_cast<uint32_t *>(device.mapMemory(memory0, 0, VK_WHOLE_SIZE, {}, dynamic));
+        table_mapping = static_cast<uint32_t *>(device.mapMemory(memory1, 0, VK_WHOLE_SIZE, {}, dynamic));
+    }
+
+    /// @brief copy the page pool and the page table to the host
+    void ReadBack() noexcept(false) {
+        std::lock_guard lck{queue_mtx};
+        Submit([this](vk::CommandBuffer command) {
+            command.copyBuffer(stream->get_buffer(), pool_readback, vk::BufferCopy{0, 0, page_size * resident_count},
+                               dynamic);
+            command.copyBuffer(stream->get_page_table_buffer(), table_readback,
+                               vk::BufferCopy{0, 0, sizeof(uint32_t) * virtual_count}, dynamic);
+        });
+    }
+
+    /// @return number of resident pages. their contents must match the loader
+    uint32_t ExpectResidentPages() noexcept(false) {
+        ReadBack();
+        uint32_t count = 0;
+        for (uint32_t vpage = 0; vpage < virtual_count; ++vpage) {
+            const uint32_t ppage = table_mapping[vpage];
+            if (ppage == experiment::page_table::invalid)
+                continue;
+            EXPECT_LT(ppage, resident_count);
+            const uint32_t *values = pool_mapping + ppage * page_size / sizeof(uint32_t);
+            for (uint32_t i = 0; i < page_size / sizeof(uint32_t); ++i)
+                EXPECT_EQ(values[i], Pattern(vpage, i));
+            ++count;
+        }
+        return count;
+    }
+    bool IsResident(uint32_t vpage) const noexcept {
+        return table_mapping[vpage] != experiment::page_table::invalid;
+    }
+};
+
+TEST_F(StreamingBufferTest, acquire_and_evict) {
+    ASSERT_EQ(stream->get_mode(), experiment::streaming_buffer_mode::software);
+    stream->acquire(0, page_size * 2);
+    ASSERT_EQ(ExpectResidentPages(), 2);
+    ASSERT_TRUE(IsResident(0));
+    ASSERT_TRUE(IsResident(1));
+
+    // the pool has only 1 free page. released pages are evicted
+    stream->release(0, page_size * 2);
+    stream->acquire(page_size * 2, page_size * 3);
+    ASSERT_EQ(ExpectResidentPages(), resident_count);
+    for (uint32_t vpage : {2, 3, 4})
+        ASSERT_TRUE(IsResident(vpage));
+    stream->release(page_size * 2, page_size * 3);
+}
+
+TEST_F(StreamingBufferTest, acquire_larger_than_pool) {
+    stream->acquire(page_size * 2, page_size * 3);
+    // every physical page is pinned
+    ASSERT_THROW(stream->acquire(page_size * 5, page_size), std::runtime_error);
+    ASSERT_EQ(ExpectResidentPages(), resident_count);
+    ASSERT_FALSE(IsResident(5));
+    stream->release(page_size * 2, page_size * 3);
+
+    ASSERT_THROW(stream->acquire(0, page_size * (resident_count + 1)), std::runtime_error);
+    ASSERT_EQ(ExpectResidentPages(), resident_count);
+    ASSERT_FALSE(IsResident(resident_count));
+
+    // pins of the failed acquire are released. the pages can be evicted again
+    stream->acquire(page_size * 5, page_size * 3);
+    ASSERT_EQ(ExpectResidentPages(), resident_count);
+    for (uint32_t vpage : {5, 6, 7})
+        ASSERT_TRUE(IsResident(vpage));
+    stream->release(page_size * 5, page_size * 3);
+}
+
+TEST_F(StreamingBufferTest, prefetch) {
+    stream->prefetch(page_size * 6, page_size * 2);
+    // the prefetch thread loads the pages later
+    for (auto i = 0; i < 100; ++i) {
+        ReadBack();
+        if (IsResident(6) && IsResident(7))
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    }
+    ASSERT_EQ(ExpectResidentPages(), 2);
+    ASSERT_TRUE(IsResident(6));
+    ASSERT_TRUE(IsResident(7));
+}
+
+TEST_F(StreamingBufferTest, sequential_prefetch) {
+    stream->set_prefetch_distance(2);
+    stream->acquire(0, page_size);
+    stream->release(0, page_size);
+    // sequential. the prefetch thread loads the page 2 and 3
+    stream->acquire(page_size, page_size);
+    stream->set_prefetch_distance(0);
+    // the page may be in loading by the prefetch thread. it must be waited
+    stream->acquire(page_size * 2, page_size);
+    ReadBack();
+    ASSERT_TRUE(IsResident(1));
+    ASSERT_TRUE(IsResident(2));
+
+    for (auto i = 0; i < 100; ++i) {
+        ReadBack();
+        if (IsResident(3))
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    }
+    // the page 0 is evicted for the page 3
+    ASSERT_EQ(ExpectResidentPages(), resident_count);
+    for (uint32_t vpage : {1, 2, 3})
+        ASSERT_TRUE(IsResident(vpage));
+    stream->release(page_size, page_size * 2);
+}
+
+/// @brief `streaming_buffer_mode::sparse`. Skipped if the device or the queue family doesn't support it
+struct SparseStreamingBufferTest : public StreamingBufferTest {
+    void SetUp() {
+        ComputeTest::SetUp();
+        if (IsSkipped())
+            return;
+        if (experiment::query_streaming_buffer_mode(pdevice, dynamic, queue_family) ==
+            experiment::streaming_buffer_mode::software)
+            GTEST_SKIP() << "sparse residency buffer is not supported";
+        vk::PhysicalDeviceFeatures2 features{};
+        features.features.setSparseBinding(true);
+        features.features.setSparseResidencyBuffer(true);
+        MakeComputeDevice(&features, {});
+        // pages are made of whole sparse blocks. see streaming_buffer::get_page_size
+        const vk::DeviceSize alignment = GetSparseBlockSize();
+        page_size = (page_size + alignment - 1) / alignment * alignment;
+        MakeStream(experiment::streaming_buffer_mode::sparse);
+    }
+
+  protected:
+    vk::DeviceSize GetSparseBlockSize() noexcept(false) {
+        vk::BufferCreateInfo info{};
+        info.setFlags(vk::BufferCreateFlagBits::eSparseBinding | vk::BufferCreateFlagBits::eSparseResidency);
+        info.setSize(page_size * virtual_count);
+        info.setUsage(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc |
+                      vk::BufferUsageFlagBits::eTransferDst);
+        info.setSharingMode(vk::SharingMode::eExclusive);
+        vk::Buffer buffer = device.createBuffer(info, nullptr, dynamic);
+        vk::MemoryRequirements reqs = device.getBufferMemoryRequirements(buffer, dynamic);
+        device.destroyBuffer(buffer, nullptr, dynamic);
+        return reqs.alignment;
+    }
+
+    /// @brief copy the pages from their virtual offsets. their contents must match the loader
+    /// @note  the pages must be acquired
+    void ExpectPages(uint32_t first, uint32_t count) noexcept(false) {
+        {
+            std::lock_guard lck{queue_mtx};
+            Submit([this, first, count](vk::CommandBuffer command) {
+                const vk::DeviceSize offset = first * page_size;
+                command.copyBuffer(stream->get_buffer(), virtual_readback,
+                                   vk::BufferCopy{offset, offset, count * page_size}, dynamic);
+            });
+        }
+        for (uint32_t vpage = first; vpage < first + count; ++vpage) {
+            const uint32_t *values = virtual_mapping + vpage * page_size / sizeof(uint32_t);
+            uint32_t mismatch = 0;
+            for (uint32_t i = 0; i < page_size / sizeof(uint32_t); ++i)
+                if (values[i] != Pattern(vpage, i))
+                    ++mismatch;
+            EXPECT_EQ(mismatch, 0) << "page " << vpage;
+        }
+    }
+};
+
+TEST_F(SparseStreamingBufferTest, acquire_and_evict) {
+    ASSERT_EQ(stream->get_mode(), experiment::streaming_buffer_mode::sparse);
+    ASSERT_EQ(stream->get_page_size(), page_size);
+    ASSERT_EQ(stream->get_page_table_buffer(), vk::Buffer{});
+    stream->acquire(0, page_size * 2);
+    ExpectPages(0, 2);
+
+    // the pool has only 1 free page. released pages are evicted and unbound
+    stream->release(0, page_size * 2);
+    stream->acquire(page_size * 2, page_size * 3);
+    ExpectPages(2, 3);
+    stream->release(page_size * 2, page_size * 3);
+}
+
+TEST_F(SparseStreamingBufferTest, acquire_larger_than_pool) {
+    stream->acquire(page_size * 2, page_size * 3);
+    ASSERT_THROW(stream->acquire(page_size * 5, page_size), std::runtime_error);
+    ExpectPages(2, 3);
+    stream->release(page_size * 2, page_size * 3);
+
+    // pins of the failed acquire are released. the pages are bound again
+    ASSERT_THROW(stream->acquire(0, page_size * (resident_count + 1)), std::runtime_error);
+    stream->acquire(page_size * 5, page_size * 3);
+    ExpectPages(5, 3);
+    stream->release(page_size * 5, page_size * 3);
+}
@@ -19,7 +19,7 @@
 #define VK_USE_PLATFORM_WIN32_KHR
 #include <vulkan/vulkan.hpp>
 
-struct VulkanTest : public testing::Test {
+struct VulkanLibraryTest : public testing::Test {
     HMODULE mod = nullptr;
 
     void SetUp() final {
@@ -33,7 +33,7 @@ struct VulkanTest : public testing::Test {
     }
 };
 
-TEST_F(VulkanTest, AvailableVersion) {
+TEST_F(VulkanLibraryTest, AvailableVersion) {
     if (mod == NULL)
         GTEST_SKIP();
     ASSERT_TRUE(check_vulkan_available(), true);